@@ -25,9 +25,12 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 
 /* Default file permissions are DEF_MODE & ~DEF_UMASK */
 /* $begin createmasks */
@@ -51,6 +54,16 @@ typedef struct {
 } rio_t;
 /* $end rio_t */
 
+/* Output queue for the non-blocking Rio functions */
+#define RIO_WOULDBLOCK -2      /* Returned instead of waiting for data */
+typedef struct {
+    int out_fd;                /* Descriptor the queue drains to */
+    char *out_buf;             /* Bytes the socket hasn't taken yet */
+    size_t out_off;            /* First unsent byte in out_buf */
+    size_t out_len;            /* End of queued bytes in out_buf */
+    size_t out_cap;            /* Allocated size of out_buf */
+} rio_out_t;
+
 /* External variables */
 extern int h_errno;    /* Defined by BIND for DNS errors */ 
 extern char **environ; /* Defined by libc */
@@ -177,7 +190,24 @@ ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd); 
 ssize_t	rio_readnb(rio_t *rp, void *usrbuf, size_t n);
+ssize_t	rio_readsomeb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t	rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt);
+ssize_t rio_readlinev(rio_t *rp, char **linep);
+ssize_t rio_peekb(rio_t *rp, char **bufp, size_t n);
+ssize_t rio_consumeb(rio_t *rp, size_t n);
+ssize_t rio_peekmore(rio_t *rp, char **bufp, size_t *cntp);
+
+/* Non-blocking Rio package */
+int rio_readinitb_nb(rio_t *rp, int fd);
+ssize_t rio_readlinev_nb(rio_t *rp, char **linep);
+ssize_t rio_readnb_nb(rio_t *rp, void *usrbuf, size_t n);
+void rio_outinit(rio_out_t *op, int fd);
+void rio_outfree(rio_out_t *op);
+ssize_t rio_writen_nb(rio_out_t *op, const void *usrbuf, size_t n);
+ssize_t rio_outqueue(rio_out_t *op, const void *usrbuf, size_t n);
+ssize_t rio_flush_nb(rio_out_t *op);
+size_t rio_outpending(rio_out_t *op);
 
 /* Wrappers for Rio package */
 ssize_t Rio_readn(int fd, void *usrbuf, size_t n);
@@ -185,9 +215,15 @@ void Rio_writen(int fd, void *usrbuf, size_t n);
 void Rio_readinitb(rio_t *rp, int fd); 
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+void Rio_writev(int fd, struct iovec *iov, int iovcnt);
+ssize_t Rio_readlinev(rio_t *rp, char **linep);
+ssize_t Rio_peekb(rio_t *rp, char **bufp, size_t n);
 
 /* Reentrant protocol-independent client/server helpers */
 int open_clientfd(char *hostname, char *port);
+int open_clientfd_ai(struct addrinfo *listp);
+void open_clientfd_config(int timeout_ms, int delay_ms);
+void open_clientfd_setup(void (*setup)(int fd));
 int open_listenfd(char *port);
 
 /* Wrappers for reentrant protocol-independent client/server helpers */
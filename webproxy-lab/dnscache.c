@@ -0,0 +1,241 @@
+/*
+ * dnscache.c - 원 서버 연결용 스레드 안전 DNS 캐시 (dnscache.h 참고)
+ */
+#include "dnscache.h"
+
+#define DNS_BUCKETS 256     // 해시 버킷 수
+#define DNS_MAX_ENTRIES 1024  // 최대 항목 수 (살아 있는 항목으로 가득 차면 새 이름은 캐시하지 않고 조회만)
+
+enum { DNS_PENDING, DNS_READY };  // 항목 상태
+
+typedef struct dns_entry {
+  char *host;             // 조회한 호스트
+  char *port;             // 조회한 포트
+  int state;              // DNS_PENDING: getaddrinfo 진행 중, DNS_READY: 결과 있음
+  int error;              // 실패 시 EAI_* 코드 (성공이면 0)
+  dns_addrs_t *addrs;     // 성공 시 조회 결과
+  time_t expires;         // 만료 시각
+  int refreshing;         // 백그라운드 갱신 진행 여부
+  pthread_cond_t ready;   // PENDING -> READY 전환 시 broadcast
+  int waiters;            // ready를 기다리는 스레드 수 (깨어나 결과를 읽을 때까지 정리되지 않음)
+
+  struct dns_entry *next; // 같은 버킷의 다음 항목
+} dns_entry_t;
+
+static struct {
+  dns_entry_t *buckets[DNS_BUCKETS];
+  pthread_mutex_t mutex;  // 테이블, 항목, 통계 보호
+  int ttl;                // 성공 결과 TTL (초)
+  int neg_ttl;            // 실패 결과 TTL (초)
+  int refresh_ahead;      // 만료 몇 초 전부터 미리 갱신할지 (초)
+  time_t next_sweep;      // 다음에 만료된 항목을 정리할 시각 (ttl마다 한 번)
+  dns_stats_t stats;
+} dns;
+
+static unsigned dns_hash(const char *host, const char *port) {
+  unsigned h = 5381;
+  for (const char *c = host; *c; c++) h = h * 33 + tolower((unsigned char)*c);
+  for (const char *c = port; *c; c++) h = h * 33 + *c;
+  return h % DNS_BUCKETS;
+}
+
+static int dns_resolve(const char *host, const char *port, struct addrinfo **listp) {
+  struct addrinfo hints;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;  // open_clientfd와 같은 조건
+  return getaddrinfo(host, port, &hints, listp);
+}
+
+static dns_addrs_t *dns_addrs_new(struct addrinfo *ai) {
+  dns_addrs_t *addrs = Malloc(sizeof(dns_addrs_t));
+  addrs->refcnt = 1;
+  addrs->ai = ai;
+  return addrs;
+}
+
+// 캐시를 거치지 않는 조회 (캐시를 끈 경우, 테이블이 가득 찬 경우)
+static int dns_lookup_uncached(const char *host, const char *port, dns_addrs_t **addrs) {
+  struct addrinfo *ai;
+  int rc = dns_resolve(host, port, &ai);
+  if (rc == 0) {
+    *addrs = dns_addrs_new(ai);
+  }
+  return rc;
+}
+
+void dns_release(dns_addrs_t *addrs) {
+  if (__atomic_sub_fetch(&addrs->refcnt, 1, __ATOMIC_ACQ_REL) > 0) return;
+  freeaddrinfo(addrs->ai);
+  free(addrs);
+}
+
+// 조회 결과를 항목에 저장 (mutex를 잡은 상태에서 호출)
+static void dns_store(dns_entry_t *e, int rc, struct addrinfo *ai) {
+  if (e->addrs) {
+    dns_release(e->addrs);  // 사용 중인 스레드가 있다면 마지막 사용 후 해제됨
+    e->addrs = NULL;
+  }
+  e->error = rc;
+  if (rc == 0) {
+    e->addrs = dns_addrs_new(ai);
+  }
+  e->expires = time(NULL) + (rc == 0 ? dns.ttl : dns.neg_ttl);
+  e->state = DNS_READY;
+}
+
+// 만료된 항목 정리 (mutex를 잡은 상태에서 호출)
+//    PENDING 항목과, READY가 되었어도 기다리던 스레드가 아직 mutex를 다시 잡지 못한 항목은 유지
+static void dns_sweep(time_t now) {
+  for (int i = 0; i < DNS_BUCKETS; i++) {
+    dns_entry_t **pp = &dns.buckets[i];
+    while (*pp) {
+      dns_entry_t *e = *pp;
+      if (e->state == DNS_READY && !e->refreshing && e->waiters == 0 && e->expires <= now) {
+        *pp = e->next;
+        if (e->addrs) dns_release(e->addrs);
+        pthread_cond_destroy(&e->ready);
+        free(e->host);
+        free(e->port);
+        free(e);
+        dns.stats.entries--;
+      } else {
+        pp = &e->next;
+      }
+    }
+  }
+}
+
+typedef struct {
+  dns_entry_t *entry;   // 갱신할 항목 (refreshing이 설정되어 있는 동안은 정리되지 않음)
+} dns_refresh_t;
+
+static void *dns_refresh_thread(void *vargp) {
+  dns_entry_t *e = ((dns_refresh_t *)vargp)->entry;
+  struct addrinfo *ai;
+  free(vargp);
+  pthread_detach(pthread_self());
+
+  int rc = dns_resolve(e->host, e->port, &ai);
+
+  pthread_mutex_lock(&dns.mutex);
+  if (rc == 0) {
+    dns_store(e, rc, ai);   // 새 결과로 교체, 기존 결과를 쓰는 스레드는 참조로 보호됨
+    dns.stats.refreshes++;
+  }                         // 실패하면 기존 결과를 만료 시각까지 유지
+  e->refreshing = 0;
+  pthread_mutex_unlock(&dns.mutex);
+  return NULL;
+}
+
+void dns_cache_init(int ttl, int neg_ttl, int refresh_ahead) {
+  memset(&dns, 0, sizeof(dns));
+  pthread_mutex_init(&dns.mutex, NULL);
+  dns.ttl = ttl;
+  dns.neg_ttl = neg_ttl;
+  dns.refresh_ahead = refresh_ahead;
+}
+
+int dns_lookup(const char *host, const char *port, dns_addrs_t **addrs) {
+  unsigned h = dns_hash(host, port);
+  time_t now = time(NULL);
+  dns_entry_t *e;
+  int rc;
+
+  if (dns.ttl <= 0) {  // 캐시 비활성화
+    return dns_lookup_uncached(host, port, addrs);
+  }
+
+  pthread_mutex_lock(&dns.mutex);
+  for (e = dns.buckets[h]; e; e = e->next) {
+    if (strcasecmp(e->host, host) == 0 && strcmp(e->port, port) == 0) break;
+  }
+
+  if (e && e->state == DNS_PENDING) {
+    // 같은 이름을 다른 스레드가 조회 중: 그 결과를 기다림
+    dns.stats.collapsed++;
+    e->waiters++;
+    while (e->state == DNS_PENDING) {
+      pthread_cond_wait(&e->ready, &dns.mutex);
+    }
+    e->waiters--;
+  } else if (e && e->expires > now) {
+    if (e->error) {
+      dns.stats.neg_hits++;
+    } else {
+      dns.stats.hits++;
+      // 만료가 가까우면 백그라운드에서 미리 갱신 (항목당 하나)
+      if (!e->refreshing && e->expires - now <= dns.refresh_ahead) {
+        pthread_t tid;
+        dns_refresh_t *task = Malloc(sizeof(dns_refresh_t));
+        task->entry = e;
+        e->refreshing = 1;
+        if (pthread_create(&tid, NULL, dns_refresh_thread, task) != 0) {
+          e->refreshing = 0;
+          free(task);
+        }
+      }
+    }
+  } else {
+    // 없거나 만료된 항목: 이 스레드가 조회하고 나머지는 기다리게 함
+    if (e == NULL) {
+      // 만료된 항목은 ttl마다 한 번 정리 (새 이름을 넣을 때만 테이블 전체를 훑음)
+      if (now >= dns.next_sweep) {
+        dns_sweep(now);
+        dns.next_sweep = now + dns.ttl;
+      }
+      if (dns.stats.entries >= DNS_MAX_ENTRIES) {
+        dns.stats.misses++;
+        pthread_mutex_unlock(&dns.mutex);
+        return dns_lookup_uncached(host, port, addrs);
+      }
+      e = Calloc(1, sizeof(dns_entry_t));
+      e->host = strdup(host);
+      e->port = strdup(port);
+      pthread_cond_init(&e->ready, NULL);
+      e->next = dns.buckets[h];
+      dns.buckets[h] = e;
+      dns.stats.entries++;
+    }
+    e->state = DNS_PENDING;
+    dns.stats.misses++;
+    pthread_mutex_unlock(&dns.mutex);
+
+    struct addrinfo *ai;
+    rc = dns_resolve(host, port, &ai);
+
+    pthread_mutex_lock(&dns.mutex);
+    dns_store(e, rc, ai);
+    pthread_cond_broadcast(&e->ready);
+  }
+
+  rc = e->error;
+  if (rc == 0) {
+    __atomic_add_fetch(&e->addrs->refcnt, 1, __ATOMIC_RELAXED);
+    *addrs = e->addrs;
+  }
+  pthread_mutex_unlock(&dns.mutex);
+  return rc;
+}
+
+int dns_open_clientfd(char *host, char *port) {
+  dns_addrs_t *addrs;
+  int rc, clientfd;
+
+  if ((rc = dns_lookup(host, port, &addrs)) != 0) {
+    fprintf(stderr, "getaddrinfo failed (%s:%s): %s\n", host, port, gai_strerror(rc));
+    return -2;
+  }
+  clientfd = open_clientfd_ai(addrs->ai);
+  int saved = errno;  // 호출자가 연결 실패 원인(ETIMEDOUT 등)을 볼 수 있도록 보존
+  dns_release(addrs);
+  errno = saved;
+  return clientfd;
+}
+
+void dns_cache_stats(dns_stats_t *stats) {
+  pthread_mutex_lock(&dns.mutex);
+  *stats = dns.stats;
+  pthread_mutex_unlock(&dns.mutex);
+}
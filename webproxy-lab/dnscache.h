@@ -0,0 +1,34 @@
+/*
+ * dnscache.h - 원 서버 연결용 스레드 안전 DNS 캐시
+ *
+ * (host, port)별로 getaddrinfo 결과를 TTL 동안 보관하고, 실패 결과도 짧게
+ * 기억한다. 같은 이름을 동시에 조회하면 한 스레드만 getaddrinfo를 호출하고
+ * 나머지는 그 결과를 기다린다. 만료가 가까운 항목은 조회 시 백그라운드에서
+ * 미리 갱신한다.
+ */
+#ifndef __DNSCACHE_H__
+#define __DNSCACHE_H__
+
+#include "csapp.h"
+
+typedef struct {
+  int refcnt;               // 참조 수 (캐시 항목 1 + 사용 중인 스레드 수)
+  struct addrinfo *ai;      // getaddrinfo 결과
+} dns_addrs_t;  // 공유되는 조회 결과
+
+typedef struct {
+  unsigned long hits;       // 캐시에서 주소를 돌려준 횟수
+  unsigned long misses;     // getaddrinfo를 호출한 횟수
+  unsigned long neg_hits;   // 기억된 조회 실패를 돌려준 횟수
+  unsigned long collapsed;  // 진행 중인 조회를 기다려 결과를 받은 횟수
+  unsigned long refreshes;  // 만료 전에 백그라운드에서 갱신한 횟수
+  unsigned long entries;    // 현재 캐시 항목 수
+} dns_stats_t;  // DNS 캐시 통계
+
+void dns_cache_init(int ttl, int neg_ttl, int refresh_ahead);  // TTL, 실패 TTL, 만료 몇 초 전부터 갱신할지 (초)
+int dns_lookup(const char *host, const char *port, dns_addrs_t **addrs);  // 조회 (성공 시 0, 실패 시 EAI_* 코드)
+void dns_release(dns_addrs_t *addrs);   // 조회 결과 참조 해제
+int dns_open_clientfd(char *host, char *port);  // 캐시된 주소로 연결 (DNS 실패 -2, 연결 실패 -1)
+void dns_cache_stats(dns_stats_t *stats);  // 통계 복사
+
+#endif /* __DNSCACHE_H__ */
@@ -0,0 +1,310 @@
+/*
+ * h2.c - HTTP/2 프레임과 HPACK 헤더 압축 (h2.h 참고)
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "h2.h"
+
+// RFC 7541 부록 A 정적 테이블 (1번부터)
+static const struct {
+  const char *name;
+  const char *value;
+} static_table[] = {
+  {NULL, NULL},
+  {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+  {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+  {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+  {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+  {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+  {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+  {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+  {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+  {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+  {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+  {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+  {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+  {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+  {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+  {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+  {"www-authenticate", ""},
+};
+#define STATIC_ENTRIES 61
+
+// RFC 7541 부록 B Huffman 부호 길이 (256번은 EOS)
+// 부호는 (길이, 심볼) 순으로 붙인 정규(canonical) 부호이므로 길이만으로 복원할 수 있음
+static const unsigned char huff_len[257] = {
+  13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+  28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+  6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+  5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+  13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+  15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+  6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+  20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+  24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+  22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+  21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+  26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+  19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+  20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+  26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+  30,
+};
+
+static uint16_t huff_syms[257];     // (길이, 심볼) 순으로 정렬한 심볼
+static uint32_t huff_first[31];     // 길이별 첫 부호
+static uint32_t huff_count[31];     // 길이별 심볼 수
+static uint32_t huff_index[31];     // 길이별 첫 심볼의 huff_syms 위치
+static pthread_once_t huff_once = PTHREAD_ONCE_INIT;
+
+static void huff_build(void) {
+  uint32_t code = 0, k = 0;
+
+  for (int len = 1; len <= 30; len++) {
+    huff_first[len] = code;
+    huff_index[len] = k;
+    for (int s = 0; s < 257; s++) {
+      if (huff_len[s] == len) huff_syms[k++] = s;
+    }
+    huff_count[len] = k - huff_index[len];
+    code = (code + huff_count[len]) << 1;
+  }
+}
+
+// 한 비트씩 읽으며 현재 길이의 부호 범위에 들어오면 심볼 하나 (out에는 최대 len * 8 / 5바이트)
+static int huff_decode(const unsigned char *in, size_t len, char *out, size_t *outlen) {
+  uint32_t code = 0;
+  int bits = 0;
+  size_t n = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    for (int b = 7; b >= 0; b--) {
+      code = code << 1 | (in[i] >> b & 1);
+      bits++;
+      if (code - huff_first[bits] < huff_count[bits]) {
+        int sym = huff_syms[huff_index[bits] + code - huff_first[bits]];
+        if (sym == 256) return -1;  // 문자열 안의 EOS
+        out[n++] = sym;
+        code = 0;
+        bits = 0;
+      } else if (bits == 30) {
+        return -1;
+      }
+    }
+  }
+  if (bits > 7 || code != (1u << bits) - 1) return -1;  // 패딩은 7비트 이하의 EOS 앞부분(모두 1)
+  *outlen = n;
+  return 0;
+}
+
+// prefix비트 접두 정수 (RFC 7541 5.1)
+static int int_decode(const unsigned char **p, const unsigned char *end, int prefix, uint32_t *v) {
+  uint32_t max = (1u << prefix) - 1;
+
+  if (*p >= end) return -1;
+  uint32_t x = *(*p)++ & max;
+  if (x == max) {
+    for (int shift = 0; ; shift += 7) {
+      if (*p >= end || shift > 21) return -1;  // 2^28을 넘는 값은 받지 않음
+      uint32_t b = *(*p)++;
+      x += (b & 0x7f) << shift;
+      if (!(b & 0x80)) break;
+    }
+  }
+  *v = x;
+  return 0;
+}
+
+static size_t int_encode(unsigned char *out, int prefix, int pattern, uint32_t v) {
+  uint32_t max = (1u << prefix) - 1;
+  size_t n = 1;
+
+  if (v < max) {
+    out[0] = pattern | v;
+    return 1;
+  }
+  out[0] = pattern | max;
+  for (v -= max; v >= 128; v >>= 7) out[n++] = (v & 0x7f) | 0x80;
+  out[n++] = v;
+  return n;
+}
+
+// 문자열 리터럴 (Huffman이면 풀어서 out에)
+static int str_decode(const unsigned char **p, const unsigned char *end, char *out, size_t *outlen) {
+  uint32_t len;
+
+  if (*p >= end) return -1;
+  int huff = **p & 0x80;
+  if (int_decode(p, end, 7, &len) < 0 || len > (size_t)(end - *p)) return -1;
+  if (huff) {
+    if (huff_decode(*p, len, out, outlen) < 0) return -1;
+  } else {
+    memcpy(out, *p, len);
+    *outlen = len;
+  }
+  *p += len;
+  return 0;
+}
+
+void h2_frame_read(const unsigned char *p, h2_frame_t *f) {
+  f->len = (uint32_t)p[0] << 16 | p[1] << 8 | p[2];
+  f->type = p[3];
+  f->flags = p[4];
+  f->stream = ((uint32_t)p[5] << 24 | p[6] << 16 | p[7] << 8 | p[8]) & 0x7fffffff;
+}
+
+void h2_frame_write(unsigned char *p, size_t len, int type, int flags, uint32_t stream) {
+  p[0] = len >> 16;
+  p[1] = len >> 8;
+  p[2] = len;
+  p[3] = type;
+  p[4] = flags;
+  p[5] = stream >> 24 & 0x7f;
+  p[6] = stream >> 16;
+  p[7] = stream >> 8;
+  p[8] = stream;
+}
+
+void hpack_init(hpack_table_t *t) {
+  pthread_once(&huff_once, huff_build);
+  memset(t, 0, sizeof(*t));
+  t->max = HPACK_TABLE_SIZE;
+}
+
+void hpack_free(hpack_table_t *t) {
+  while (t->n > 0) {
+    free(t->ent[(t->head - --t->n + HPACK_MAX_ENTRIES) % HPACK_MAX_ENTRIES].data);
+  }
+  t->size = 0;
+}
+
+// 크기가 max 이하가 될 때까지 가장 오래된 항목부터 버림
+static void table_evict(hpack_table_t *t, size_t max) {
+  while (t->n > 0 && t->size > max) {
+    hpack_entry_t *e = &t->ent[(t->head - (t->n - 1) + HPACK_MAX_ENTRIES) % HPACK_MAX_ENTRIES];
+    t->size -= e->nlen + e->vlen + 32;
+    free(e->data);
+    t->n--;
+  }
+}
+
+// 새 항목을 먼저 복사한 뒤 공간을 비움 (이름이 곧 버려질 항목을 가리킬 수 있음)
+static int table_add(hpack_table_t *t, const char *name, size_t nlen, const char *value, size_t vlen) {
+  size_t size = nlen + vlen + 32;
+  char *data = malloc(nlen + vlen + 1);
+
+  if (data == NULL) return -1;
+  memcpy(data, name, nlen);
+  memcpy(data + nlen, value, vlen);
+  table_evict(t, size <= t->max ? t->max - size : 0);
+  if (size > t->max) {  // 테이블보다 큰 항목은 테이블을 비우기만 함
+    free(data);
+    return 0;
+  }
+  t->head = (t->head + 1) % HPACK_MAX_ENTRIES;
+  t->ent[t->head] = (hpack_entry_t){data, nlen, vlen};
+  t->n++;
+  t->size += size;
+  return 0;
+}
+
+// 색인 -> 이름과 값 (1~61은 정적 테이블, 그 뒤는 동적 테이블의 최근 항목부터)
+static int table_get(const hpack_table_t *t, uint32_t idx, const char **name, size_t *nlen,
+                     const char **value, size_t *vlen) {
+  if (idx == 0) return -1;
+  if (idx <= STATIC_ENTRIES) {
+    *name = static_table[idx].name;
+    *nlen = strlen(*name);
+    *value = static_table[idx].value;
+    *vlen = strlen(*value);
+    return 0;
+  }
+  idx -= STATIC_ENTRIES + 1;
+  if (idx >= (uint32_t)t->n) return -1;
+  const hpack_entry_t *e = &t->ent[(t->head - idx + HPACK_MAX_ENTRIES) % HPACK_MAX_ENTRIES];
+  *name = e->data;
+  *nlen = e->nlen;
+  *value = e->data + e->nlen;
+  *vlen = e->vlen;
+  return 0;
+}
+
+int hpack_decode(hpack_table_t *t, const unsigned char *in, size_t len, hpack_emit_t emit, void *arg) {
+  const unsigned char *p = in, *end = in + len;
+  char *scratch = malloc(2 * len + 2);  // Huffman으로 풀면 최대 8/5배
+  const char *name, *value;
+  size_t nlen, vlen;
+  uint32_t idx;
+  int rc = -1;
+
+  if (scratch == NULL) return -1;
+  while (p < end) {
+    int b = *p;
+    if (b & 0x80) {  // 색인된 필드
+      if (int_decode(&p, end, 7, &idx) < 0 || table_get(t, idx, &name, &nlen, &value, &vlen) < 0) goto out;
+    } else if ((b & 0xe0) == 0x20) {  // 동적 테이블 크기 갱신
+      if (int_decode(&p, end, 5, &idx) < 0 || idx > HPACK_TABLE_SIZE) goto out;
+      t->max = idx;
+      table_evict(t, t->max);
+      continue;
+    } else {  // 리터럴 (01: 테이블에 추가, 0000: 추가 안 함, 0001: 중계자도 추가 금지)
+      int prefix = (b & 0xc0) == 0x40 ? 6 : 4;
+      if (int_decode(&p, end, prefix, &idx) < 0) goto out;
+      if (idx == 0) {
+        if (str_decode(&p, end, scratch, &nlen) < 0) goto out;
+        name = scratch;
+      } else if (table_get(t, idx, &name, &nlen, &value, &vlen) < 0) {
+        goto out;
+      }
+      char *vbuf = name == scratch ? scratch + nlen : scratch;
+      if (str_decode(&p, end, vbuf, &vlen) < 0) goto out;
+      value = vbuf;
+      if (prefix == 6 && table_add(t, name, nlen, value, vlen) < 0) goto out;
+    }
+    if (emit(arg, name, nlen, value, vlen) != 0) {
+      rc = 1;
+      goto out;
+    }
+  }
+  rc = 0;
+out:
+  free(scratch);
+  return rc;
+}
+
+size_t hpack_encode_status(unsigned char *out, int status) {
+  static const int indexed[] = {200, 204, 206, 304, 400, 404, 500};  // 정적 테이블 8~14번
+
+  for (int i = 0; i < 7; i++) {
+    if (status == indexed[i]) {
+      out[0] = 0x80 | (8 + i);
+      return 1;
+    }
+  }
+  out[0] = 0x08;  // 이름은 정적 테이블 8번, 값은 세 자리 리터럴
+  out[1] = 3;
+  out[2] = '0' + status / 100 % 10;
+  out[3] = '0' + status / 10 % 10;
+  out[4] = '0' + status % 10;
+  return 5;
+}
+
+size_t hpack_encode(unsigned char *out, const char *name, size_t nlen, const char *value, size_t vlen) {
+  size_t n = 0;
+  int idx = 0;
+
+  for (int i = 15; i <= STATIC_ENTRIES && idx == 0; i++) {  // 헤더 이름은 15번부터
+    if (strlen(static_table[i].name) == nlen && memcmp(static_table[i].name, name, nlen) == 0) idx = i;
+  }
+  n += int_encode(out, 4, 0x00, idx);
+  if (idx == 0) {
+    n += int_encode(out + n, 7, 0x00, nlen);
+    memcpy(out + n, name, nlen);
+    n += nlen;
+  }
+  n += int_encode(out + n, 7, 0x00, vlen);
+  memcpy(out + n, value, vlen);
+  return n + vlen;
+}
@@ -0,0 +1,81 @@
+/*
+ * h2.h - HTTP/2 프레임과 HPACK 헤더 압축 (RFC 9113, RFC 7541)
+ *
+ * 소켓을 다루지 않는 코덱만 담는다. 프레임 헤더 9바이트를 읽고 쓰는 함수와
+ * HPACK 디코더(정적/동적 테이블, Huffman), 응답용 인코더가 있다. 인코더는
+ * 동적 테이블을 쓰지 않고 정적 테이블 이름 + 리터럴 값만 내보내므로 상대
+ * 디코더와 맞춰야 할 상태가 없다. 스트림과 흐름 제어는 proxy.c가 맡는다.
+ */
+#ifndef __H2_H__
+#define __H2_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"  // 클라이언트 연결 서문
+#define H2_PREFACE_LEN 24
+#define H2_FRAME_HEADER 9         // 프레임 헤더 크기
+#define H2_MAX_FRAME 16384        // SETTINGS_MAX_FRAME_SIZE 기본값 (바꾸지 않으므로 받는 최대 페이로드)
+#define H2_WINDOW 65535           // 흐름 제어 윈도 초기값
+#define HPACK_TABLE_SIZE 4096     // 동적 테이블 크기 상한 (SETTINGS_HEADER_TABLE_SIZE 기본값)
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / 32)  // 항목마다 32바이트가 더해지므로 최대 항목 수
+
+enum {
+  H2_DATA, H2_HEADERS, H2_PRIORITY, H2_RST_STREAM, H2_SETTINGS,
+  H2_PUSH_PROMISE, H2_PING, H2_GOAWAY, H2_WINDOW_UPDATE, H2_CONTINUATION,
+};  // 프레임 종류
+
+enum {
+  H2_FLAG_END_STREAM = 0x1,   // DATA, HEADERS: 스트림의 마지막 프레임
+  H2_FLAG_ACK = 0x1,          // SETTINGS, PING: 응답
+  H2_FLAG_END_HEADERS = 0x4,  // HEADERS, CONTINUATION: 헤더 블록의 끝
+  H2_FLAG_PADDED = 0x8,       // DATA, HEADERS: 패딩 길이 바이트가 앞에 있음
+  H2_FLAG_PRIORITY = 0x20,    // HEADERS: 우선순위 필드 5바이트가 앞에 있음
+};  // 프레임 플래그
+
+enum {
+  H2_NO_ERROR, H2_PROTOCOL_ERROR, H2_INTERNAL_ERROR, H2_FLOW_CONTROL_ERROR,
+  H2_SETTINGS_TIMEOUT, H2_STREAM_CLOSED, H2_FRAME_SIZE_ERROR, H2_REFUSED_STREAM,
+  H2_CANCEL, H2_COMPRESSION_ERROR, H2_CONNECT_ERROR, H2_ENHANCE_YOUR_CALM,
+};  // RST_STREAM, GOAWAY 에러 코드
+
+enum {
+  H2_SET_HEADER_TABLE_SIZE = 1, H2_SET_ENABLE_PUSH, H2_SET_MAX_CONCURRENT_STREAMS,
+  H2_SET_INITIAL_WINDOW_SIZE, H2_SET_MAX_FRAME_SIZE, H2_SET_MAX_HEADER_LIST_SIZE,
+};  // SETTINGS 항목
+
+typedef struct {
+  uint32_t len;         // 페이로드 길이
+  int type;             // H2_* 프레임 종류
+  int flags;            // H2_FLAG_*
+  uint32_t stream;      // 스트림 ID (0이면 연결 전체)
+} h2_frame_t;   // 프레임 헤더
+
+typedef struct {
+  char *data;           // 이름 뒤에 값 (malloc)
+  size_t nlen;          // 이름 길이
+  size_t vlen;          // 값 길이
+} hpack_entry_t;  // 동적 테이블 항목
+
+typedef struct {
+  hpack_entry_t ent[HPACK_MAX_ENTRIES];  // 원형 배열 (head가 가장 최근 항목)
+  int head;             // 가장 최근 항목 위치
+  int n;                // 항목 수
+  size_t size;          // 항목 크기 합 (이름 + 값 + 32)
+  size_t max;           // 현재 최대 크기 (헤더 블록의 크기 갱신으로 바뀜)
+} hpack_table_t;  // HPACK 디코더의 동적 테이블
+
+// 헤더 하나를 받는 콜백 (이름과 값은 콜백 안에서만 유효, 0이 아니면 디코딩 중단)
+typedef int (*hpack_emit_t)(void *arg, const char *name, size_t nlen, const char *value, size_t vlen);
+
+void h2_frame_read(const unsigned char *p, h2_frame_t *f);  // 프레임 헤더 9바이트 해석
+void h2_frame_write(unsigned char *p, size_t len, int type, int flags, uint32_t stream);  // 프레임 헤더 9바이트 작성
+void hpack_init(hpack_table_t *t);  // 빈 동적 테이블
+void hpack_free(hpack_table_t *t);  // 동적 테이블 항목 해제
+int hpack_decode(hpack_table_t *t, const unsigned char *in, size_t len,
+                 hpack_emit_t emit, void *arg);  // 헤더 블록 디코딩 (0: 성공, -1: 압축 형식 오류, 콜백이 멈추면 1)
+size_t hpack_encode_status(unsigned char *out, int status);  // :status 필드 (최대 5바이트)
+size_t hpack_encode(unsigned char *out, const char *name, size_t nlen, const char *value,
+                    size_t vlen);  // 색인하지 않는 리터럴 필드 (이름은 소문자, 최대 nlen + vlen + 12바이트)
+
+#endif /* __H2_H__ */
@@ -0,0 +1,243 @@
+/*
+ * hdrrules.c - 원 서버별 요청/응답 헤더 재작성 규칙 (hdrrules.h 참고)
+ */
+#include "hdrrules.h"
+
+#define HDR_CUSTOM_IDS (HDR_RULE_IDS - HTTP_H_KINDS)  // 테이블마다 이름으로 찾을 수 있는 헤더 수
+
+enum { HR_ADD, HR_REMOVE, HR_REPLACE, HR_DEFAULT };  // 규칙 동작
+
+typedef struct hdr_rule {
+  int scope;                // HDR_REQUEST, HDR_RESPONSE
+  char *origin;             // 원 서버 호스트 (NULL이면 모든 원 서버)
+  int action;               // HR_*
+  char *name;               // 헤더 이름
+  int id;                   // HTTP_H_* (모르는 헤더는 HTTP_H_OTHER)
+  char *line;               // 붙일 줄 "이름: 값\r\n" (remove는 NULL)
+  size_t len;               // line의 길이
+  struct hdr_rule *next;    // 설정 파일에서 다음에 적힌 규칙
+} hdr_rule_t;  // 설정 파일에 적힌 규칙 하나
+
+struct hdr_table {
+  char *origin;                       // 원 서버 호스트 (NULL이면 모든 원 서버)
+  size_t origin_len;                  // origin의 길이
+  unsigned char drop[HDR_RULE_IDS];   // 원래 줄을 버릴 헤더 (remove, replace)
+  char *always;                       // 항상 붙일 줄을 이어 붙인 것 (add, replace)
+  size_t always_len;                  // always의 길이
+  struct {
+    int id;                           // 헤더 ID
+    const char *line;                 // 붙일 줄
+    size_t len;                       // line의 길이
+  } defaults[HDR_RULE_IDS];           // 메시지에 그 헤더가 없을 때만 붙일 줄 (default)
+  int ndefaults;                      // defaults 개수
+  const char *custom[HDR_CUSTOM_IDS]; // HTTP_H_KINDS + i번 ID의 헤더 이름
+  size_t custom_len[HDR_CUSTOM_IDS];  // 이름 길이
+  int ncustom;                        // 이름으로 찾는 헤더 수
+  size_t extra;                       // hdr_rule_append가 쓸 수 있는 최대 바이트
+  struct hdr_table *next;             // 같은 메시지 종류의 다음 원 서버
+};
+
+static hdr_rule_t *rules, **rules_tail = &rules;  // 추가된 순서대로
+static hdr_table_t *tables[HDR_SCOPES];           // 원 서버별 테이블 (모든 원 서버용 규칙도 포함)
+static hdr_table_t *global[HDR_SCOPES];           // 규칙이 원 서버를 지정하지 않은 경우의 테이블
+
+// 연결 관리, 메시지 프레이밍, 캐시 상태처럼 프록시가 직접 정하는 헤더는 규칙으로 바꿀 수 없음
+static int is_reserved(int id) {
+  switch (id) {
+  case HTTP_H_HOST:
+  case HTTP_H_EXPECT:
+  case HTTP_H_RANGE:
+  case HTTP_H_CONNECTION:
+  case HTTP_H_PROXY_CONNECTION:
+  case HTTP_H_KEEP_ALIVE:
+  case HTTP_H_TE:
+  case HTTP_H_TRAILER:
+  case HTTP_H_TRANSFER_ENCODING:
+  case HTTP_H_UPGRADE:
+  case HTTP_H_AGE:
+  case HTTP_H_X_CACHE:
+  case HTTP_H_CONTENT_LENGTH:
+    return 1;
+  }
+  return 0;
+}
+
+int hdr_rule_add(int scope, const char *origin, const char *action, const char *name, const char *value) {
+  static const char *actions[] = {"add", "remove", "replace", "default"};
+  size_t nlen = strlen(name);
+  int act = -1;
+
+  for (int i = 0; i < 4; i++) {
+    if (strcmp(action, actions[i]) == 0) act = i;
+  }
+  if (act < 0 || nlen == 0 || strpbrk(name, ": \t\r\n")) return -1;
+  if (act == HR_REMOVE ? value != NULL && value[0] != '\0' : value == NULL || strpbrk(value, "\r\n")) {
+    return -1;  // remove에만 값이 없음
+  }
+  int id = http_header_id(name, nlen);
+  if (is_reserved(id)) return -1;
+
+  hdr_rule_t *r = Malloc(sizeof(hdr_rule_t));
+  r->scope = scope;
+  r->origin = strcmp(origin, "*") == 0 ? NULL : strdup(origin);
+  r->action = act;
+  r->name = strdup(name);
+  r->id = id;
+  r->line = NULL;
+  r->len = 0;
+  if (act != HR_REMOVE) {
+    r->len = nlen + strlen(value) + 4;
+    r->line = Malloc(r->len + 1);
+    sprintf(r->line, "%s: %s\r\n", name, value);
+  }
+  r->next = NULL;
+  *rules_tail = r;
+  rules_tail = &r->next;
+  return 0;
+}
+
+// 이 테이블에 적용되는 규칙인지 (origin이 NULL인 테이블에는 모든 원 서버용 규칙만)
+static int applies(const hdr_rule_t *r, int scope, const char *origin) {
+  return r->scope == scope && (r->origin == NULL || (origin && strcasecmp(r->origin, origin) == 0));
+}
+
+// 규칙의 헤더 ID (모르는 헤더는 테이블 안에서 이름마다 번호를 붙임, 자리가 없으면 -1)
+static int table_id(hdr_table_t *t, const hdr_rule_t *r) {
+  if (r->id != HTTP_H_OTHER) return r->id;
+  size_t len = strlen(r->name);
+  for (int k = 0; k < t->ncustom; k++) {
+    if (t->custom_len[k] == len && strcasecmp(t->custom[k], r->name) == 0) return HTTP_H_KINDS + k;
+  }
+  if (t->ncustom == HDR_CUSTOM_IDS) return -1;
+  t->custom[t->ncustom] = r->name;
+  t->custom_len[t->ncustom] = len;
+  return HTTP_H_KINDS + t->ncustom++;
+}
+
+// 테이블에 적용되는 규칙을 평가 순서대로 out에 모음 (모든 원 서버용 규칙을 적힌 순서대로, 그 뒤에 원 서버 지정 규칙)
+static int ordered_rules(int scope, const char *origin, const hdr_rule_t **out) {
+  int n = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    for (const hdr_rule_t *r = rules; r; r = r->next) {
+      if (applies(r, scope, origin) && (r->origin != NULL) == pass) out[n++] = r;
+    }
+  }
+  return n;
+}
+
+// 규칙을 평가 순서대로 보며 테이블 하나를 만듦 (적용되는 규칙이 없으면 NULL)
+//    remove와 replace는 같은 헤더에 대해 앞서 평가된 규칙을 모두 무효로 함
+//    default는 그 뒤에 add나 replace가 살아 있으면 의미가 없으므로 버림
+static hdr_table_t *compile_table(int scope, const char *origin) {
+  int since[HDR_RULE_IDS], has[HDR_RULE_IDS] = {0}, i, n, id;
+  const hdr_rule_t *def[HDR_RULE_IDS] = {NULL};
+  int def_at[HDR_RULE_IDS];
+  size_t total = 0;
+  const hdr_rule_t *r, **order;
+
+  for (n = 0, r = rules; r; r = r->next) n++;
+  order = Malloc((n + 1) * sizeof(hdr_rule_t *));
+  if ((n = ordered_rules(scope, origin, order)) == 0) {
+    free(order);
+    return NULL;
+  }
+  hdr_table_t *t = Calloc(1, sizeof(hdr_table_t));
+  for (id = 0; id < HDR_RULE_IDS; id++) since[id] = -1;
+
+  // 1. 헤더마다 마지막 remove/replace와 default의 위치
+  for (i = 0; i < n; i++) {
+    r = order[i];
+    if ((id = table_id(t, r)) < 0) {
+      fprintf(stderr, "헤더 규칙에 적힌 헤더 종류가 너무 많습니다 (원 서버 %s)\n", origin ? origin : "*");
+      exit(1);
+    }
+    if (r->action == HR_REMOVE || r->action == HR_REPLACE) {
+      since[id] = i;
+    } else if (r->action == HR_DEFAULT) {
+      def[id] = r;
+      def_at[id] = i;
+    }
+    total += r->len;
+  }
+
+  // 2. 살아 있는 add와 replace를 평가 순서대로 이어 붙임
+  t->always = Malloc(total + 1);
+  for (i = 0; i < n; i++) {
+    r = order[i];
+    id = table_id(t, r);
+    if ((r->action == HR_ADD && i > since[id]) || (r->action == HR_REPLACE && i == since[id])) {
+      memcpy(t->always + t->always_len, r->line, r->len);
+      t->always_len += r->len;
+      has[id] = 1;
+    }
+  }
+  free(order);
+  t->extra = t->always_len;
+  for (id = 0; id < HDR_RULE_IDS; id++) {
+    t->drop[id] = since[id] >= 0;
+    if (def[id] && def_at[id] > since[id] && !has[id]) {
+      t->defaults[t->ndefaults].id = id;
+      t->defaults[t->ndefaults].line = def[id]->line;
+      t->defaults[t->ndefaults++].len = def[id]->len;
+      t->extra += def[id]->len;
+    }
+  }
+  if (t->extra > HDR_RULE_EXTRA_MAX) {
+    fprintf(stderr, "헤더 규칙이 붙이는 줄이 너무 깁니다 (원 서버 %s, %zu바이트)\n", origin ? origin : "*", t->extra);
+    exit(1);
+  }
+  return t;
+}
+
+void hdr_rules_compile(void) {
+  for (int scope = 0; scope < HDR_SCOPES; scope++) {
+    global[scope] = compile_table(scope, NULL);
+    for (hdr_rule_t *r = rules; r; r = r->next) {
+      if (r->scope != scope || r->origin == NULL || hdr_rules_lookup(scope, r->origin, strlen(r->origin)) != global[scope]) {
+        continue;  // 이미 만든 원 서버
+      }
+      hdr_table_t *t = compile_table(scope, r->origin);
+      t->origin = r->origin;
+      t->origin_len = strlen(r->origin);
+      t->next = tables[scope];
+      tables[scope] = t;
+    }
+  }
+}
+
+// 규칙을 지정한 원 서버는 많지 않다고 보고 차례로 비교
+const hdr_table_t *hdr_rules_lookup(int scope, const char *host, size_t len) {
+  for (hdr_table_t *t = tables[scope]; t; t = t->next) {
+    if (t->origin_len == len && strncasecmp(t->origin, host, len) == 0) return t;
+  }
+  return global[scope];
+}
+
+int hdr_rule_keep(const hdr_table_t *t, int id, const char *name, size_t len, uint64_t *seen) {
+  if (t == NULL) return 1;
+  if (id == HTTP_H_OTHER) {  // 규칙이 이름으로 지정한 헤더인지
+    int k = 0;
+    while (k < t->ncustom && (t->custom_len[k] != len || strncasecmp(t->custom[k], name, len) != 0)) k++;
+    if (k == t->ncustom) return 1;
+    id = HTTP_H_KINDS + k;
+  }
+  *seen |= 1ULL << id;
+  return !t->drop[id];
+}
+
+size_t hdr_rule_extra(const hdr_table_t *t) {
+  return t ? t->extra : 0;
+}
+
+size_t hdr_rule_append(const hdr_table_t *t, uint64_t seen, char *out) {
+  if (t == NULL) return 0;
+  size_t n = t->always_len;
+  memcpy(out, t->always, n);
+  for (int i = 0; i < t->ndefaults; i++) {
+    int id = t->defaults[i].id;
+    if ((seen >> id & 1) && !t->drop[id]) continue;  // 원래 줄이 남아 있음
+    memcpy(out + n, t->defaults[i].line, t->defaults[i].len);
+    n += t->defaults[i].len;
+  }
+  return n;
+}
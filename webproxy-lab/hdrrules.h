@@ -0,0 +1,34 @@
+/*
+ * hdrrules.h - 원 서버별 요청/응답 헤더 재작성 규칙
+ *
+ * 설정 파일의 규칙(add, remove, replace, default)을 시작할 때 원 서버마다
+ * 헤더 ID로 바로 찾는 테이블로 컴파일한다. 헤더를 복사하는 쪽은 줄마다
+ * hdr_rule_keep으로 남길지만 묻고, 끝에서 hdr_rule_append로 붙일 줄을 한 번에
+ * 덧붙인다. 붙일 줄은 미리 이어 붙여 두므로 규칙 평가에 바이트 단위 비용이
+ * 없고, 출력 버퍼는 hdr_rule_extra만큼 더 잡아 두면 한 번에 채울 수 있다.
+ * 테이블은 시작할 때 만든 뒤 바뀌지 않으므로 락 없이 읽는다.
+ */
+#ifndef __HDRRULES_H__
+#define __HDRRULES_H__
+
+#include <stdint.h>
+#include "csapp.h"
+#include "httpparse.h"
+
+#define HDR_RULE_IDS 64         // 테이블의 헤더 ID 수 (HTTP_H_* 다음부터는 이름으로 찾는 헤더)
+#define HDR_RULE_EXTRA_MAX 4096 // 규칙이 메시지 하나에 붙일 수 있는 최대 바이트
+
+enum { HDR_REQUEST, HDR_RESPONSE, HDR_SCOPES };  // 규칙을 적용할 메시지
+
+typedef struct hdr_table hdr_table_t;  // 컴파일된 규칙 (원 서버 하나, 메시지 종류 하나)
+
+int hdr_rule_add(int scope, const char *origin, const char *action, const char *name,
+                 const char *value);  // 규칙 추가 (origin "*"는 모든 원 서버). 잘못된 규칙이면 -1
+void hdr_rules_compile(void);          // 추가된 규칙을 원 서버별 테이블로 컴파일 (시작할 때 한 번)
+const hdr_table_t *hdr_rules_lookup(int scope, const char *host, size_t len);  // 원 서버에 적용할 테이블 (없으면 NULL)
+int hdr_rule_keep(const hdr_table_t *t, int id, const char *name, size_t len,
+                  uint64_t *seen);     // 헤더 줄을 남길지 (본 헤더는 seen에 기록)
+size_t hdr_rule_extra(const hdr_table_t *t);  // hdr_rule_append가 쓸 수 있는 최대 바이트
+size_t hdr_rule_append(const hdr_table_t *t, uint64_t seen, char *out);  // 규칙이 붙이는 줄을 out에 씀 (쓴 바이트 수)
+
+#endif /* __HDRRULES_H__ */
@@ -0,0 +1,388 @@
+/*
+ * httpparse.c - 재개 가능한 HTTP/1.x 요청 헤더 파서 (httpparse.h 참고)
+ */
+#include <string.h>
+#include "httpparse.h"
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+enum {
+  S_START,        // 요청 줄 앞의 빈 줄 건너뛰기
+  S_METHOD,       // 메서드 토큰
+  S_URI_START,    // 메서드 뒤 공백
+  S_URI,          // 요청 대상
+  S_VERSION,      // "HTTP/x.y"
+  S_LINE_LF,      // 요청 줄의 CR 다음 LF
+  S_HDR_START,    // 헤더 줄 시작 (또는 빈 줄)
+  S_HDR_NAME,     // 헤더 이름
+  S_HDR_OWS,      // ':' 뒤 공백
+  S_HDR_VALUE,    // 헤더 값
+  S_HDR_LF,       // 헤더 줄의 CR 다음 LF
+  S_END_LF,       // 빈 줄의 CR 다음 LF
+  S_DONE,
+};
+
+// RFC 9110 tchar: 메서드와 헤더 이름에 쓸 수 있는 문자
+static const unsigned char tchar[256] = {
+  ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1,
+  ['+'] = 1, ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1, ['~'] = 1,
+  ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+  ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1, ['G'] = 1, ['H'] = 1, ['I'] = 1,
+  ['J'] = 1, ['K'] = 1, ['L'] = 1, ['M'] = 1, ['N'] = 1, ['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1,
+  ['S'] = 1, ['T'] = 1, ['U'] = 1, ['V'] = 1, ['W'] = 1, ['X'] = 1, ['Y'] = 1, ['Z'] = 1,
+  ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1, ['g'] = 1, ['h'] = 1, ['i'] = 1,
+  ['j'] = 1, ['k'] = 1, ['l'] = 1, ['m'] = 1, ['n'] = 1, ['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1,
+  ['s'] = 1, ['t'] = 1, ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1, ['y'] = 1, ['z'] = 1,
+};
+
+// 헤더 값에 올 수 없는 제어 문자 (HTAB 제외)
+#define IS_CTL(c) (((c) < 0x20 && (c) != '\t') || (c) == 0x7f)
+
+// 헤더 값을 훑다가 멈춰야 하는 문자: 공백, 줄 끝, 제어 문자 (나머지는 한꺼번에 건너뜀)
+static const unsigned char vstop[256] = {
+  [0x00] = 1, [0x01] = 1, [0x02] = 1, [0x03] = 1, [0x04] = 1, [0x05] = 1, [0x06] = 1, [0x07] = 1,
+  [0x08] = 1, [0x09] = 1, [0x0a] = 1, [0x0b] = 1, [0x0c] = 1, [0x0d] = 1, [0x0e] = 1, [0x0f] = 1,
+  [0x10] = 1, [0x11] = 1, [0x12] = 1, [0x13] = 1, [0x14] = 1, [0x15] = 1, [0x16] = 1, [0x17] = 1,
+  [0x18] = 1, [0x19] = 1, [0x1a] = 1, [0x1b] = 1, [0x1c] = 1, [0x1d] = 1, [0x1e] = 1, [0x1f] = 1,
+  [' '] = 1, [0x7f] = 1,
+};
+
+// 프록시가 아는 헤더 이름 (소문자, 32바이트로 0 채움). 길이순으로 정렬되어 있고
+// by_len[n]..by_len[n + 1]이 길이 n인 항목들의 범위 (항목을 추가하면 by_len도 갱신)
+#define NAME_BLOCK 32
+static const struct {
+  char name[NAME_BLOCK] __attribute__((aligned(16)));
+  int id;
+} known[] = {
+  {"te", HTTP_H_TE},
+  {"age", HTTP_H_AGE},
+  {"date", HTTP_H_DATE},
+  {"etag", HTTP_H_ETAG},
+  {"host", HTTP_H_HOST},
+  {"vary", HTTP_H_VARY},
+  {"range", HTTP_H_RANGE},
+  {"expect", HTTP_H_EXPECT},
+  {"pragma", HTTP_H_PRAGMA},
+  {"expires", HTTP_H_EXPIRES},
+  {"trailer", HTTP_H_TRAILER},
+  {"upgrade", HTTP_H_UPGRADE},
+  {"x-cache", HTTP_H_X_CACHE},
+  {"if-range", HTTP_H_IF_RANGE},
+  {"connection", HTTP_H_CONNECTION},
+  {"keep-alive", HTTP_H_KEEP_ALIVE},
+  {"user-agent", HTTP_H_USER_AGENT},
+  {"content-type", HTTP_H_CONTENT_TYPE},
+  {"cache-control", HTTP_H_CACHE_CONTROL},
+  {"content-range", HTTP_H_CONTENT_RANGE},
+  {"if-none-match", HTTP_H_IF_NONE_MATCH},
+  {"last-modified", HTTP_H_LAST_MODIFIED},
+  {"content-length", HTTP_H_CONTENT_LENGTH},
+  {"accept-encoding", HTTP_H_ACCEPT_ENCODING},
+  {"content-encoding", HTTP_H_CONTENT_ENCODING},
+  {"proxy-connection", HTTP_H_PROXY_CONNECTION},
+  {"if-modified-since", HTTP_H_IF_MODIFIED_SINCE},
+  {"transfer-encoding", HTTP_H_TRANSFER_ENCODING},
+  {"proxy-authenticate", HTTP_H_PROXY_AUTHENTICATE},
+  {"proxy-authorization", HTTP_H_PROXY_AUTHORIZATION},
+};
+
+static const unsigned char by_len[NAME_BLOCK + 2] = {
+  0, 0, 0, 1, 2, 6, 7, 9, 13, 14, 14, 17, 17, 18, 22, 23,
+  24, 26, 28, 29, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30,
+  30, 30,
+};
+
+int http_header_id(const char *name, size_t len) {
+  char lower[NAME_BLOCK] __attribute__((aligned(16))) = {0};
+  int i, end;
+
+  if (len == 0 || len > NAME_BLOCK || by_len[len] == by_len[len + 1]) return HTTP_H_OTHER;
+  memcpy(lower, name, len);  // 0으로 채운 블록에 복사해 버퍼 끝 너머를 읽지 않음
+
+#ifdef __SSE2__
+  // 두 16바이트 블록을 한꺼번에 소문자로: 'A'..'Z'인 바이트에만 0x20을 더함
+  const __m128i upper_a = _mm_set1_epi8('A' - 1), upper_z = _mm_set1_epi8('Z' + 1);
+  const __m128i bit = _mm_set1_epi8(0x20);
+  __m128i lo = _mm_load_si128((const __m128i *)lower);
+  __m128i hi = _mm_load_si128((const __m128i *)(lower + 16));
+  lo = _mm_or_si128(lo, _mm_and_si128(bit, _mm_and_si128(_mm_cmpgt_epi8(lo, upper_a), _mm_cmplt_epi8(lo, upper_z))));
+  hi = _mm_or_si128(hi, _mm_and_si128(bit, _mm_and_si128(_mm_cmpgt_epi8(hi, upper_a), _mm_cmplt_epi8(hi, upper_z))));
+
+  // 같은 길이의 후보(대부분 1~2개)만 블록 단위로 비교
+  for (i = by_len[len], end = by_len[len + 1]; i < end; i++) {
+    __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(lo, _mm_load_si128((const __m128i *)known[i].name)),
+                               _mm_cmpeq_epi8(hi, _mm_load_si128((const __m128i *)(known[i].name + 16))));
+    if (_mm_movemask_epi8(eq) == 0xffff) return known[i].id;
+  }
+#else
+  for (i = 0; i < (int)len; i++) {
+    if (lower[i] >= 'A' && lower[i] <= 'Z') lower[i] += 0x20;
+  }
+  for (i = by_len[len], end = by_len[len + 1]; i < end; i++) {
+    if (memcmp(lower, known[i].name, NAME_BLOCK) == 0) return known[i].id;
+  }
+#endif
+  return HTTP_H_OTHER;
+}
+
+void http_req_init(http_req_t *r) {
+  r->state = S_START;
+  r->pos = r->mark = r->ows = 0;
+  r->nhdrs = 0;
+  r->status = 0;
+}
+
+static int fail(http_req_t *r, int status) {
+  r->status = status;
+  return HTTP_PARSE_ERROR;
+}
+
+// "HTTP/x.y" 확인 (한 자리 버전만 허용)
+static int parse_version(http_req_t *r, const char *v, size_t len) {
+  if (len != 8 || memcmp(v, "HTTP/", 5) != 0 || v[6] != '.' ||
+      v[5] < '0' || v[5] > '9' || v[7] < '0' || v[7] > '9') {
+    return fail(r, 400);
+  }
+  r->major = v[5] - '0';
+  r->minor = v[7] - '0';
+  if (r->major != 1) return fail(r, 505);
+  return 1;
+}
+
+static int end_header(http_req_t *r, size_t end) {
+  http_hdr_t *h = &r->hdrs[r->nhdrs - 1];
+  h->value.off = r->mark;
+  h->value.len = end - r->mark;
+  return 1;
+}
+
+int http_parse_request(http_req_t *r, const char *buf, size_t len) {
+  const unsigned char *b = (const unsigned char *)buf;
+  size_t p = r->pos;
+  int state = r->state;
+
+  if (state == S_DONE) return (int)p;
+
+  for (; p < len; p++) {
+    unsigned char c = b[p];
+
+    switch (state) {
+    case S_START:
+      if (c == '\r' || c == '\n') break;  // 요청 앞의 빈 줄은 무시 (RFC 9112 2.2)
+      if (!tchar[c]) return fail(r, 400);
+      r->mark = p;
+      state = S_METHOD;
+      break;
+
+    case S_METHOD:
+      while (p < len && tchar[b[p]]) p++;  // 토큰 끝까지 한꺼번에
+      if (p == len) goto again;
+      if (b[p] != ' ') return fail(r, 400);
+      r->method.off = r->mark;
+      r->method.len = p - r->mark;
+      state = S_URI_START;
+      break;
+
+    case S_URI_START:
+      if (c <= ' ' || c == 0x7f) return fail(r, 400);
+      r->mark = p;
+      state = S_URI;
+      break;
+
+    case S_URI:
+      while (p < len && b[p] > ' ' && b[p] != 0x7f) p++;
+      if (p == len) goto again;
+      if (b[p] != ' ') return fail(r, 400);  // HTTP/0.9 요청이나 제어 문자
+      r->uri.off = r->mark;
+      r->uri.len = p - r->mark;
+      r->mark = p + 1;
+      state = S_VERSION;
+      break;
+
+    case S_VERSION:
+      if (c == '\r' || c == '\n') {
+        if (parse_version(r, buf + r->mark, p - r->mark) < 0) return HTTP_PARSE_ERROR;
+        state = c == '\r' ? S_LINE_LF : S_HDR_START;
+      } else if (p - r->mark >= 8) {
+        return fail(r, 400);
+      }
+      break;
+
+    case S_LINE_LF:
+    case S_HDR_LF:
+      if (c != '\n') return fail(r, 400);
+      state = S_HDR_START;
+      break;
+
+    case S_HDR_START:
+      if (c == '\r') {
+        state = S_END_LF;
+      } else if (c == '\n') {
+        p++;
+        goto done;
+      } else if (tchar[c]) {
+        if (r->nhdrs == HTTP_MAX_HEADERS) return fail(r, 431);
+        r->mark = p;
+        state = S_HDR_NAME;
+      } else {
+        return fail(r, 400);  // obs-fold(공백으로 시작하는 이어진 줄) 포함
+      }
+      break;
+
+    case S_HDR_NAME:
+      while (p < len && tchar[b[p]]) p++;
+      if (p == len) goto again;
+      if (b[p] != ':') return fail(r, 400);  // 이름과 ':' 사이 공백도 거부 (RFC 9112 5.1)
+      {
+        http_hdr_t *h = &r->hdrs[r->nhdrs++];
+        h->name.off = r->mark;
+        h->name.len = p - r->mark;
+        h->id = http_header_id(buf + r->mark, p - r->mark);
+      }
+      state = S_HDR_OWS;
+      break;
+
+    case S_HDR_OWS:
+      if (c == ' ' || c == '\t') break;
+      r->mark = r->ows = p;
+      if (c == '\r' || c == '\n') {  // 빈 값
+        end_header(r, p);
+        state = c == '\r' ? S_HDR_LF : S_HDR_START;
+        break;
+      }
+      if (IS_CTL(c)) return fail(r, 400);
+      r->ows = p + 1;
+      state = S_HDR_VALUE;
+      break;
+
+    case S_HDR_VALUE:
+      // 줄 끝까지 한꺼번에, 끝의 공백은 ows로 제외
+      for (;;) {
+        size_t run = p;
+        while (p < len && !vstop[b[p]]) p++;
+        if (p > run) r->ows = p;  // 마지막으로 본 공백이 아닌 문자 다음
+        if (p == len) goto again;
+        c = b[p];
+        if (c == ' ' || c == '\t') {
+          p++;
+          continue;
+        }
+        if (c == '\r' || c == '\n') break;
+        return fail(r, 400);  // 제어 문자
+      }
+      end_header(r, r->ows);
+      state = c == '\r' ? S_HDR_LF : S_HDR_START;
+      break;
+
+    case S_END_LF:
+      if (c != '\n') return fail(r, 400);
+      p++;
+      goto done;
+    }
+  }
+
+again:
+  r->pos = p;
+  r->state = state;
+  return HTTP_PARSE_AGAIN;
+
+done:
+  r->pos = p;
+  r->state = S_DONE;
+  return (int)p;
+}
+
+enum {
+  C_SIZE,         // 16진수 chunk 크기
+  C_EXT,          // 크기 뒤의 확장(";name=value")과 CR, 줄 끝까지 무시
+  C_DATA,         // chunk 데이터
+  C_DATA_CR,      // 데이터 뒤 CR
+  C_DATA_LF,      // 데이터 뒤 LF
+  C_TRAILER,      // trailer 줄 시작 (또는 마지막 빈 줄)
+  C_TRAILER_LINE, // trailer 줄 (무시)
+  C_END_LF,       // 마지막 빈 줄의 CR 다음 LF
+  C_DONE,
+};
+
+void http_chunked_init(http_chunked_t *c) {
+  c->state = C_SIZE;
+  c->digits = 0;
+  c->size = 0;
+}
+
+long http_chunked_decode(http_chunked_t *c, const char *in, size_t len, char *out, size_t *outlen) {
+  size_t p = 0, o = 0;
+
+  while (p < len && c->state != C_DONE) {
+    unsigned char ch = in[p];
+    switch (c->state) {
+    case C_SIZE: {
+      int v = ch >= '0' && ch <= '9' ? ch - '0'
+            : (ch | 0x20) >= 'a' && (ch | 0x20) <= 'f' ? (ch | 0x20) - 'a' + 10 : -1;
+      if (v < 0) {
+        if (c->digits == 0) return -1;  // 크기가 없는 줄
+        c->state = C_EXT;
+        continue;
+      }
+      if (++c->digits > 15) return -1;  // 비정상적으로 큰 chunk
+      c->size = c->size * 16 + v;
+      p++;
+      break;
+    }
+
+    case C_EXT:
+      if (ch == '\n') {
+        c->state = c->size ? C_DATA : C_TRAILER;
+        c->digits = 0;
+      }
+      p++;
+      break;
+
+    case C_DATA: {
+      size_t n = len - p < c->size ? len - p : c->size;  // 데이터는 한 번에 복사
+      if (out) memmove(out + o, in + p, n);  // out이 NULL이면 프레이밍만 따라감
+      o += n;
+      p += n;
+      if ((c->size -= n) == 0) c->state = C_DATA_CR;
+      break;
+    }
+
+    case C_DATA_CR:
+      c->state = C_DATA_LF;
+      if (ch == '\r') {
+        p++;
+        break;
+      }
+      // CR 없이 LF만 쓰는 원 서버
+      /* fall through */
+    case C_DATA_LF:
+      if (ch != '\n') return -1;
+      c->state = C_SIZE;
+      p++;
+      break;
+
+    case C_TRAILER:
+      c->state = ch == '\r' ? C_END_LF : ch == '\n' ? C_DONE : C_TRAILER_LINE;
+      p++;
+      break;
+
+    case C_TRAILER_LINE:
+      if (ch == '\n') c->state = C_TRAILER;
+      p++;
+      break;
+
+    case C_END_LF:
+      if (ch != '\n') return -1;
+      c->state = C_DONE;
+      p++;
+      break;
+    }
+  }
+  *outlen = o;
+  return (long)p;
+}
+
+int http_chunked_done(const http_chunked_t *c) {
+  return c->state == C_DONE;
+}
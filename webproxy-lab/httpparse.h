@@ -0,0 +1,112 @@
+/*
+ * httpparse.h - 재개 가능한 HTTP/1.x 요청 헤더 파서
+ *
+ * 바이트를 복사하지 않고 읽기 버퍼 안의 위치(오프셋)만 기록한다. 데이터가
+ * 모자라면 HTTP_PARSE_AGAIN을 돌려주고, 같은 버퍼에 바이트가 더 붙은 뒤 다시
+ * 부르면 멈췄던 곳부터 이어서 검사한다. 버퍼가 앞으로 당겨져도(rio 압축)
+ * 버퍼 시작 기준 오프셋이므로 그대로 유효하다. 읽기 방식과 무관하므로
+ * 블로킹/논블로킹 I/O 모두에서 쓸 수 있다.
+ *
+ * 요청/응답 바디의 chunked 전송 인코딩을 푸는 디코더도 같은 방식으로 동작한다.
+ * 조각이 어디서 잘려 들어와도 상태를 이어 가며, 마지막 chunk와 trailer까지
+ * 읽으면 끝났다고 알려 준다.
+ */
+#ifndef __HTTPPARSE_H__
+#define __HTTPPARSE_H__
+
+#include <stddef.h>
+#include <string.h>
+
+#define HTTP_MAX_HEADERS 64   // 기록할 수 있는 최대 헤더 수 (넘으면 431)
+
+enum {
+  HTTP_PARSE_ERROR = -1,      // 형식 오류 (r->status에 응답할 상태 코드)
+  HTTP_PARSE_AGAIN = 0,       // 데이터가 더 필요함
+};  // http_parse_request 반환값 (양수면 빈 줄까지 포함한 헤더 블록 길이)
+
+enum {
+  HTTP_H_OTHER,
+  // 요청
+  HTTP_H_HOST,
+  HTTP_H_USER_AGENT,
+  HTTP_H_EXPECT,
+  HTTP_H_RANGE,
+  HTTP_H_IF_RANGE,
+  // hop-by-hop (연결 관련)
+  HTTP_H_CONNECTION,
+  HTTP_H_PROXY_CONNECTION,
+  HTTP_H_KEEP_ALIVE,
+  HTTP_H_TE,
+  HTTP_H_TRAILER,
+  HTTP_H_TRANSFER_ENCODING,
+  HTTP_H_UPGRADE,
+  HTTP_H_PROXY_AUTHORIZATION,
+  HTTP_H_PROXY_AUTHENTICATE,
+  // 캐시
+  HTTP_H_CACHE_CONTROL,
+  HTTP_H_PRAGMA,
+  HTTP_H_EXPIRES,
+  HTTP_H_AGE,
+  HTTP_H_DATE,
+  HTTP_H_ETAG,
+  HTTP_H_LAST_MODIFIED,
+  HTTP_H_IF_MODIFIED_SINCE,
+  HTTP_H_IF_NONE_MATCH,
+  HTTP_H_VARY,
+  HTTP_H_X_CACHE,
+  // 바디와 인코딩
+  HTTP_H_CONTENT_LENGTH,
+  HTTP_H_CONTENT_TYPE,
+  HTTP_H_CONTENT_RANGE,
+  HTTP_H_CONTENT_ENCODING,
+  HTTP_H_ACCEPT_ENCODING,
+  HTTP_H_KINDS
+};  // 프록시가 따로 처리하는 헤더 ID
+
+typedef struct {
+  unsigned off;   // 버퍼 시작 기준 오프셋
+  unsigned len;   // 길이
+} http_slice_t; // 버퍼 안의 구간
+
+typedef struct {
+  http_slice_t name;    // 헤더 이름
+  http_slice_t value;   // 앞뒤 공백을 뺀 값
+  int id;               // HTTP_H_* (모르는 헤더는 HTTP_H_OTHER)
+} http_hdr_t;
+
+typedef struct {
+  int state;            // 파서 상태 (내부용)
+  size_t pos;           // 다음에 검사할 오프셋
+  size_t mark;          // 검사 중인 토큰의 시작 오프셋
+  size_t ows;           // 헤더 값 끝의 공백을 제외한 끝 오프셋
+  http_slice_t method;  // 요청 메서드
+  http_slice_t uri;     // 요청 대상
+  int major, minor;     // HTTP 버전
+  http_hdr_t hdrs[HTTP_MAX_HEADERS];
+  int nhdrs;            // 기록된 헤더 수
+  int status;           // 실패 시 응답할 상태 코드 (400, 431, 505)
+} http_req_t; // 요청 헤더 파싱 상태와 결과
+
+typedef struct {
+  int state;            // 디코더 상태 (내부용)
+  int digits;           // 크기 줄에서 읽은 16진수 자릿수
+  unsigned long size;   // 현재 chunk에서 남은 데이터 크기
+} http_chunked_t; // chunked 바디 디코딩 상태
+
+void http_req_init(http_req_t *r);  // 새 요청을 파싱하기 전에 초기화
+int http_parse_request(http_req_t *r, const char *buf, size_t len);  // buf[0..len)에서 이어서 파싱
+int http_header_id(const char *name, size_t len);   // 헤더 이름 -> HTTP_H_* (대소문자 무시, SSE2로 16바이트씩 비교)
+void http_chunked_init(http_chunked_t *c);          // 새 chunked 바디를 읽기 전에 초기화
+long http_chunked_decode(http_chunked_t *c, const char *in, size_t len,
+                         char *out, size_t *outlen);  // in에서 데이터만 out으로 (out == in 가능, NULL이면 버림). 소비한 바이트 수, 형식 오류면 -1
+int http_chunked_done(const http_chunked_t *c);     // 마지막 chunk와 trailer까지 읽었는지
+
+#define HTTP_PTR(buf, s) ((buf) + (s).off)  // 구간의 시작 포인터
+
+// "이름: 값" 줄에서 ':' 앞까지의 길이 (':'가 없으면 len)
+static inline size_t http_name_len(const char *line, size_t len) {
+  const char *colon = memchr(line, ':', len);
+  return colon ? (size_t)(colon - line) : len;
+}
+
+#endif /* __HTTPPARSE_H__ */
@@ -0,0 +1,150 @@
+/*
+ * parse_bench.c - 요청 헤더 파서 마이크로벤치마크
+ *
+ * 같은 요청을 (1) 예전 방식: sscanf로 요청 줄 분리 + 줄마다 strncasecmp 비교 +
+ * 헤더 복사, (2) httpparse 한 번에, (3) httpparse에 16바이트씩 나눠 넣기(느린
+ * 클라이언트나 논블로킹 읽기 흉내)로 반복 파싱해 요청당 시간을 비교한다.
+ * 헤더 이름 분류도 strncasecmp 연쇄와 http_header_id를 따로 비교한다.
+ *
+ * usage: ./parse_bench [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "httpparse.h"
+
+#define MAXLINE 8192
+
+static const char small_req[] =
+  "GET http://www.example.com/index.html?q=1 HTTP/1.1\r\n"
+  "Host: www.example.com\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:120.0) Gecko/20100101 Firefox/120.0\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+  "Accept-Language: en-US,en;q=0.5\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "Connection: keep-alive\r\n"
+  "Proxy-Connection: keep-alive\r\n"
+  "Upgrade-Insecure-Requests: 1\r\n"
+  "\r\n";
+
+static char large_req[MAXLINE];
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static volatile size_t sink;  // 최적화로 루프가 사라지지 않도록
+
+// 예전 func()의 처리: 요청 줄 sscanf, 줄마다 접두사 비교 후 복사
+static void legacy_parse(const char *req, size_t len) {
+  char method[MAXLINE], uri[MAXLINE], version[MAXLINE], line[MAXLINE], hdrs[MAXLINE * 2];
+  const char *p = req, *end = req + len;
+  size_t hdrs_len = 0;
+
+  const char *nl = memchr(p, '\n', end - p);
+  memcpy(line, p, nl - p + 1);
+  line[nl - p + 1] = '\0';
+  sscanf(line, "%s %s %s", method, uri, version);
+  for (p = nl + 1; p < end; p = nl + 1) {
+    nl = memchr(p, '\n', end - p);
+    size_t n = nl - p + 1;
+    memcpy(line, p, n);
+    line[n] = '\0';
+    if (strcmp(line, "\r\n") == 0) break;
+    if (strncasecmp(line, "Host", 4) == 0 || strncasecmp(line, "User-Agent", 10) == 0 ||
+        strncasecmp(line, "Connection", 10) == 0 || strncasecmp(line, "Proxy-Connection", 16) == 0) {
+      continue;
+    }
+    if (strncasecmp(line, "Range:", 6) == 0) continue;
+    memcpy(hdrs + hdrs_len, line, n);
+    hdrs_len += n;
+  }
+  sink += hdrs_len + strlen(uri);
+}
+
+static void new_parse(const char *req, size_t len, size_t chunk) {
+  http_req_t r;
+  size_t avail = chunk < len ? chunk : len;
+  int rc;
+
+  http_req_init(&r);
+  while ((rc = http_parse_request(&r, req, avail)) == HTTP_PARSE_AGAIN) {
+    avail = avail + chunk < len ? avail + chunk : len;
+  }
+  if (rc < 0) {
+    fprintf(stderr, "parse error %d\n", r.status);
+    exit(1);
+  }
+  sink += r.nhdrs + r.uri.len;
+}
+
+static void run(const char *label, const char *req, long iters) {
+  size_t len = strlen(req);
+  double t;
+
+  t = now_ns();
+  for (long i = 0; i < iters; i++) legacy_parse(req, len);
+  printf("%-6s %5zu bytes  legacy      %8.1f ns/req\n", label, len, (now_ns() - t) / iters);
+
+  t = now_ns();
+  for (long i = 0; i < iters; i++) new_parse(req, len, len);
+  printf("%-6s %5zu bytes  httpparse   %8.1f ns/req\n", label, len, (now_ns() - t) / iters);
+
+  t = now_ns();
+  for (long i = 0; i < iters; i++) new_parse(req, len, 16);
+  printf("%-6s %5zu bytes  httpparse16 %8.1f ns/req\n", label, len, (now_ns() - t) / iters);
+}
+
+static const char *names[] = {
+  "Host", "User-Agent", "Accept", "Accept-Language", "Accept-Encoding", "Connection",
+  "Proxy-Connection", "Cookie", "Cache-Control", "If-None-Match", "Range", "Referer",
+};
+#define NNAMES (sizeof(names) / sizeof(names[0]))
+
+// 예전 방식: 관심 있는 헤더마다 strncasecmp
+static int legacy_classify(const char *name) {
+  static const char *known[] = {
+    "Host", "User-Agent", "Connection", "Proxy-Connection", "Keep-Alive", "Range",
+    "Content-Length", "Cache-Control", "Age", "X-Cache", "If-None-Match", "Accept-Encoding",
+  };
+  for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); i++) {
+    if (strncasecmp(name, known[i], strlen(known[i])) == 0) return (int)i + 1;
+  }
+  return 0;
+}
+
+static void run_classify(long iters) {
+  size_t lens[NNAMES];
+  double t;
+
+  for (size_t i = 0; i < NNAMES; i++) lens[i] = strlen(names[i]);
+
+  t = now_ns();
+  for (long i = 0; i < iters; i++) sink += legacy_classify(names[i % NNAMES]);
+  printf("name   strncasecmp  %8.1f ns/header\n", (now_ns() - t) / iters);
+
+  t = now_ns();
+  for (long i = 0; i < iters; i++) sink += http_header_id(names[i % NNAMES], lens[i % NNAMES]);
+  printf("name   header_id    %8.1f ns/header\n", (now_ns() - t) / iters);
+}
+
+int main(int argc, char **argv) {
+  long iters = argc > 1 ? atol(argv[1]) : 200000;
+  int n;
+
+  // 헤더 50개짜리 요청 (쿠키 등이 많은 경우)
+  n = sprintf(large_req, "GET http://www.example.com/a/b/c/d?x=1&y=2 HTTP/1.1\r\nHost: www.example.com\r\n");
+  for (int i = 0; i < 48; i++) {
+    n += sprintf(large_req + n, "X-Custom-Header-%02d: value-%d-abcdefghijklmnopqrstuvwxyz0123456789\r\n", i, i);
+  }
+  sprintf(large_req + n, "Connection: close\r\n\r\n");
+
+  run("small", small_req, iters);
+  run("large", large_req, iters / 5);
+  run_classify(iters * 10);
+  return 0;
+}
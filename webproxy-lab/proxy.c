@@ -1,11 +1,110 @@
 #include <stdio.h>
 #include "csapp.h"
+#include "dnscache.h"
+#include "timeout.h"
+#include "httpparse.h"
+#include "hdrrules.h"
+#include "h2.h"
+#include <linux/errqueue.h>
+#include <zlib.h>
+
+// <sys/socket.h>는 _GNU_SOURCE일 때만 accept4를 선언하는데, 그러면 csapp.h의 gai_error와 충돌함
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+// splice도 같은 이유로 직접 선언 (<fcntl.h>)
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags);
+#define SPLICE_F_MOVE 1       // 가능하면 페이지를 복사하지 않고 옮김
+#define SPLICE_F_NONBLOCK 2   // 파이프 쪽에서 막히지 않음
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
 #define NTHREADS 4
 #define SBUFSIZE 16
+#define ACCEPT_BATCH 64       // 한 번 깨어났을 때 accept할 최대 연결 수
+#define MAX_STRIP_PARAMS 32
+#define MAX_QUERY_PARAMS 64
+#define NEG_ORIGINS 64        // 실패한 원 서버를 기억하는 최대 개수
+#define NEG_TTL_DNS 30        // DNS 조회 실패 기억 시간 (초)
+#define NEG_TTL_CONNECT 5     // 연결 실패 기억 시간 (초)
+#define NEG_TTL_STATUS 10     // 4xx/5xx 응답 캐시 시간 (초)
+#define CACHE_DEFAULT_TTL 0   // Cache-Control max-age가 없을 때의 신선도 유지 시간 (초, 0이면 만료 없음)
+#define CACHE_SWR 30          // 기본 stale-while-revalidate 기간 (초)
+#define CACHE_SIE 300         // 기본 stale-if-error 기간 (초)
+#define REFRESH_THREADS 2     // 백그라운드 갱신 스레드 수 (동시 갱신 수 제한)
+#define REFRESH_QUEUE 64      // 백그라운드 갱신 대기열 크기
+#define DNS_TTL 60            // DNS 조회 결과 캐시 시간 (초, 0이면 캐시하지 않음)
+#define DNS_NEG_TTL 5         // DNS 조회 실패 캐시 시간 (초)
+#define DNS_REFRESH_AHEAD 10  // 만료 몇 초 전부터 백그라운드에서 미리 조회할지 (초)
+#define CONNECT_TIMEOUT 5000  // 원 서버 연결 전체 제한 시간 (ms, 0이면 제한 없음)
+#define CONNECT_DELAY 250     // 다음 주소로 연결을 시도하기 전 대기 시간 (ms)
+#define TIMEOUT_HEADER 10     // 클라이언트 요청 헤더 읽기 제한 시간 (초, 0이면 제한 없음)
+#define TIMEOUT_FIRST_BYTE 30 // 원 서버 응답 헤더 대기 제한 시간 (초)
+#define TIMEOUT_IDLE 30       // 응답 바디 수신 중 무응답 제한 시간 (초)
+#define TIMEOUT_TRANSFER 300  // 요청 하나의 전체 처리 제한 시간 (초)
+#define ZEROCOPY_MIN 16384    // 이 크기 이상의 캐시 응답은 MSG_ZEROCOPY로 전송 (바이트, 0이면 끔)
+#define KEEPALIVE_TIMEOUT 5   // keep-alive 연결에서 다음 요청을 기다리는 시간 (초, 0이면 keep-alive 끔)
+#define KEEPALIVE_REQUESTS 100  // 연결 하나에서 처리할 최대 요청 수
+#define PIPELINE_DEPTH 8      // 연결 하나에서 동시에 처리할 최대 요청 수 (1이면 파이프라이닝 끔)
+#define PIPELINE_MAX 32       // pipeline_depth의 상한 (순서 큐 크기)
+#define PIPELINE_THREADS 16   // 파이프라이닝/HTTP/2 요청을 처리하는 스레드 수 (모든 연결 합)
+#define PIPELINE_QUEUE 32     // 처리 스레드를 기다리는 요청 대기열 크기 (가득 차면 연결 스레드가 차례로 처리)
+#define REQ_PENDING (-2)      // 다음 요청 헤더가 아직 다 도착하지 않음 (기다리지 않고 읽을 때)
+#define RELAY_BUFSIZE 65536   // 원 서버 응답 바디와 요청 바디를 한 번에 읽는 최대 크기
+#define CONNECT_PORT "443"    // CONNECT 대상에 포트가 없을 때
+#define UPSTREAM_KEEPALIVE 30 // 원 서버 유휴 연결을 재사용하기 위해 들고 있는 시간 (초, 0이면 재사용 안 함)
+#define UPSTREAM_IDLE_MAX 64  // 풀에 들고 있을 최대 유휴 연결 수 (모든 원 서버 합)
+#define UPSTREAM_FALLBACK_TTL 300  // HTTP/1.1 요청을 거부한 원 서버에 HTTP/1.0으로 요청하는 기간 (초)
+#define H2_STREAM_BUF 32768   // HTTP/2 스트림마다 응답을 읽어 두는 버퍼 (HTTP/1.1 응답 헤더 전체가 들어가야 함)
+#define H2_OUT_HIGH 65536     // HTTP/2 송신 버퍼가 이만큼 차 있으면 새 DATA 프레임을 만들지 않음
+#define H2_HEADER_LIST 65536  // 받을 수 있는 요청 헤더 목록 크기 (SETTINGS_MAX_HEADER_LIST_SIZE)
+#define GZIP_MIN 256          // 이보다 작은 응답은 압축하지 않음 (바이트)
+#define GZIP_LEVEL 6          // zlib 압축 수준 (1: 빠름 ~ 9: 작음)
+#define GZIP_KEY_SUFFIX " gzip"  // gzip 변형의 캐시 키 = 원본 키 + 이 문자열 (정규화된 URI에는 공백이 없음)
+
+typedef struct {
+  int defer_accept;     // TCP_DEFER_ACCEPT: 요청 바이트가 도착해야 accept가 깨어남 (초, 0이면 끔)
+  int fastopen;         // TCP_FASTOPEN: 리스너는 대기열 길이, 원 서버 쪽은 1이면 TCP_FASTOPEN_CONNECT
+  int nodelay;          // TCP_NODELAY (Nagle 끄기)
+  int cork;             // 응답 헤더와 첫 바디 조각을 TCP_CORK로 묶어서 전송 (클라이언트 쪽만 사용)
+  int sndbuf;           // SO_SNDBUF (바이트, 0이면 커널 기본값)
+  int rcvbuf;           // SO_RCVBUF (바이트, 0이면 커널 기본값)
+} sock_profile_t; // 소켓 옵션 묶음 (리스너/원 서버 연결 각각 하나씩)
+
+typedef struct {
+  int sort_query;                         // 캐시 키 생성 시 쿼리 파라미터 정렬 여부
+  int nstrip;                             // 제거할 추적 파라미터 개수
+  char *strip_params[MAX_STRIP_PARAMS];   // 캐시 키에서 제거할 쿼리 파라미터 이름 (utm_source 등)
+  int neg_ttl_dns;                        // DNS 실패 네거티브 캐시 TTL (초)
+  int neg_ttl_connect;                    // 연결 실패 네거티브 캐시 TTL (초)
+  int neg_ttl_status;                     // 4xx/5xx 응답 네거티브 캐시 TTL (초)
+  int cache_default_ttl;                  // max-age가 없는 응답의 TTL (초, 0이면 만료 없음)
+  int cache_swr;                          // 응답에 stale-while-revalidate가 없을 때의 기본값 (초)
+  int cache_sie;                          // 응답에 stale-if-error가 없을 때의 기본값 (초)
+  int refresh_threads;                    // 백그라운드 갱신 스레드 수
+  int dns_ttl;                            // DNS 캐시 TTL (초, 0이면 캐시하지 않음)
+  int dns_neg_ttl;                        // DNS 조회 실패 캐시 TTL (초)
+  int dns_refresh_ahead;                  // 만료 몇 초 전부터 미리 갱신할지 (초)
+  int connect_timeout;                    // 원 서버 연결 제한 시간 (ms)
+  int connect_delay;                      // 주소 간 연결 시도 간격 (ms)
+  int timeout_header;                     // 요청 헤더 읽기 제한 시간 (초)
+  int timeout_first_byte;                 // 원 서버 첫 응답 제한 시간 (초)
+  int timeout_idle;                       // 응답 바디 무응답 제한 시간 (초)
+  int timeout_transfer;                   // 전체 전송 제한 시간 (초)
+  sock_profile_t listen;                  // 리스너 (및 accept된 클라이언트 소켓) 소켓 옵션
+  sock_profile_t upstream;                // 원 서버 연결 소켓 옵션
+  int zerocopy_min;                       // MSG_ZEROCOPY를 쓰는 최소 바디 크기 (바이트, 0이면 끔)
+  int keepalive_timeout;                  // 요청 사이 유휴 제한 시간 (초, 0이면 keep-alive 끔)
+  int upstream_keepalive;                 // 원 서버 유휴 연결 유지 시간 (초, 0이면 매번 새로 연결)
+  int upstream_idle_max;                  // 풀에 들고 있을 최대 유휴 연결 수
+  int upstream_fallback_ttl;              // HTTP/1.0으로 되돌린 원 서버를 기억하는 시간 (초)
+  int keepalive_requests;                 // 연결 하나에서 처리할 최대 요청 수
+  int pipeline_depth;                     // 연결 하나에서 동시에 처리할 최대 요청 수 (HTTP/2 동시 스트림 수)
+  int pipeline_threads;                   // 파이프라이닝/HTTP/2 요청 처리 스레드 수
+  int h2c;                                // 연결 서문이 HTTP/2이면 h2c로 처리 (prior knowledge)
+  int gzip;                               // gzip을 받는 클라이언트에게 텍스트 응답을 압축해서 보냄
+  int gzip_min;                           // 압축할 최소 바디 크기 (바이트)
+  int gzip_level;                         // zlib 압축 수준 (1~9)
+} config_t; // 프록시 설정 구조체
 
 typedef struct {
   int *buf;                     // connfd 저장 배열
@@ -18,10 +117,79 @@ typedef struct {
   pthread_cond_t items;         // 아이템이 추가되었을 때 signal
 } sbuf_t; // 작업 큐 구조체
 
+typedef struct {
+  void (*fn)(void *);           // 실행할 함수
+  void *arg;                    // 함수 인자
+} job_t;  // 작업 단위
+
+typedef struct {
+  job_t *buf;                   // 작업 저장 배열
+  int front;                    // dequeue 인덱스
+  int rear;                     // enqueue 인덱스
+  int n;                        // 배열 크기
+
+  pthread_mutex_t mutex;        // 큐 접근 mutex
+  pthread_cond_t items;         // 작업이 추가되었을 때 signal
+} pool_t; // 작업 함수를 실행하는 스레드 풀 (가득 차면 작업을 거절)
+
+typedef struct {
+  int status;           // 응답 상태 코드
+  int age;              // 원 서버가 보낸 Age 값
+  long content_length;  // Content-Length (없으면 -1)
+  int no_store;         // Cache-Control no-store/private (공유 캐시에 저장 불가)
+  int max_age;          // Cache-Control s-maxage 또는 max-age (없으면 -1)
+  int s_maxage;         // max_age가 s-maxage에서 왔는지
+  int swr;              // Cache-Control stale-while-revalidate (없으면 -1)
+  int sie;              // Cache-Control stale-if-error (없으면 -1)
+  int chunked;          // Transfer-Encoding: chunked
+  int keep_alive;       // 원 서버가 응답 후 연결을 유지함 (HTTP/1.1 기본, Connection 헤더로 바뀜)
+  int compressible;     // Content-Type이 압축해서 이득이 있는 텍스트 형식
+  int encoded;          // Content-Encoding으로 이미 인코딩된 바디
+  int gzipped;          // 그 인코딩이 gzip (gzip 변형 키로 저장)
+} resp_info_t;  // 원 서버 응답 헤더에서 뽑아낸 정보
+
+typedef struct {
+  char method[16];      // 요청 메서드 (원 서버에 그대로 전달)
+  char uri[MAXLINE];    // 요청 대상 (CONNECT라면 "host:port")
+  char range[MAXLINE];  // 클라이언트의 Range 헤더 줄 (없으면 빈 문자열)
+  char *hdrs;           // 원 서버로 전달할 요청 헤더 ("이름: 값\r\n"의 나열, malloc)
+  long body_len;        // 요청 바디 길이 (Content-Length, 바디가 없으면 0, chunked면 -1)
+  int expect_continue;  // "Expect: 100-continue" (바디를 보내기 전에 중간 응답을 기다림)
+  int tunnel;           // CONNECT 요청
+  int keep_alive;       // 응답 후 연결을 유지할지 (HTTP 버전, Connection 헤더로 결정)
+  int chunked_ok;       // HTTP/1.1 클라이언트라서 chunked 응답을 받을 수 있는지
+  int gzip_ok;          // Accept-Encoding에 gzip이 있음 (설정에서 gzip을 켠 경우만)
+  int status;           // 0이 아니면 바로 응답할 에러 상태 코드 (400, 414, 431, 501, 505)
+} client_req_t; // 읽기 버퍼에서 복사해 둔 요청 (다른 스레드에서 처리할 수 있도록)
+
+typedef struct {
+  int keep_alive;       // 클라이언트가 연결 유지를 원함
+  int close;            // 응답 후 연결을 닫아야 함 (길이를 모르는 응답, 잘린 응답 등)
+  int sock;             // 응답을 클라이언트 소켓에 직접 쓰는지 (파이프라인 응답은 파이프에 씀)
+  int chunked_ok;       // 클라이언트가 chunked 응답을 받을 수 있음 (HTTP/1.1)
+  int chunked;          // 이 응답을 chunked로 보내는 중 (원 서버가 길이를 알려 주지 않음)
+  int head;             // HEAD 요청의 응답 (헤더에 길이가 있어도 바디가 없음)
+  int gzip_ok;          // 원 서버 응답을 압축해서 보내도 됨 (gzip을 받는 클라이언트의 전체 GET)
+  int gzip;             // 이 응답을 압축해서 보내는 중 (길이를 모르게 되므로 chunked 또는 close)
+} resp_state_t; // 스레드가 지금 만들고 있는 응답의 연결 상태
+
 typedef struct cache_node {
-  char *uri;  // 요청된 URI
-  char *data; // 응답 데이터
-  int size;   // data의 크기
+  char *uri;      // 정규화된 캐시 키
+  char *hdr;      // 상태 줄 + 응답 헤더 (hop-by-hop 헤더와 빈 줄 제외)
+  int hdr_size;   // hdr의 크기
+  char *data;     // 응답 바디
+  int data_size;  // data의 크기
+  int size;       // 캐시 용량 계산에 쓰이는 전체 크기 (hdr + data)
+  int age;        // 저장 시점에 원 서버가 보낸 Age 값
+  time_t stored;  // 저장 시각
+  time_t expires; // 만료 시각 (0이면 만료 없음)
+  time_t swr_until; // 이 시각까지는 만료돼도 즉시 응답하고 백그라운드에서 갱신
+  time_t sie_until; // 이 시각까지는 원 서버 실패 시 만료된 응답으로 대신 응답
+  int refreshing; // 백그라운드 갱신이 이미 예약되었는지 (키당 하나만 갱신)
+  int status;     // 응답 상태 코드
+  int has_length; // 저장된 헤더에 Content-Length가 있는지 (없으면 적중 시 붙여서 보냄)
+  int compressible; // gzip 변형을 만들 수 있는 원본 (200, 텍스트 형식, 인코딩 없음, gzip_min 이상)
+  int refcnt;     // 참조 수 (캐시 리스트 1 + 전송 중인 스레드 수)
 
   struct cache_node *prev;  // 이전 노드
   struct cache_node *next;  // 다음 노드
@@ -35,43 +203,309 @@ typedef struct {
   pthread_rwlock_t lock; // 캐시 접근 보호 mutex
 } cache_t;  // 캐시 구조체
 
+enum { NEG_NONE, NEG_DNS, NEG_CONNECT, NEG_HTTP10 };  // 원 서버 실패 종류 (NEG_HTTP10: HTTP/1.1 요청을 처리하지 못함)
+
+typedef struct {
+  char host[MAXLINE];   // 실패한 원 서버 호스트
+  char port[10];        // 실패한 원 서버 포트
+  int kind;             // 실패 종류 (NEG_DNS, NEG_CONNECT, NEG_HTTP10)
+  time_t expires;       // 만료 시각
+} neg_origin_t; // 원 서버 실패 기록
+
+typedef struct {
+  neg_origin_t entries[NEG_ORIGINS];
+  pthread_mutex_t mutex;  // 테이블 접근 mutex
+} neg_cache_t;  // 원 서버 네거티브 캐시
+
+typedef struct {
+  char host[256];       // 원 서버 호스트 (이보다 긴 호스트의 연결은 풀에 넣지 않음)
+  char port[10];        // 원 서버 포트
+  int fd;               // 응답까지 다 읽은 연결
+  time_t since;         // 풀에 들어온 시각
+} idle_conn_t;  // 다음 요청을 기다리는 원 서버 연결
+
+typedef struct {
+  idle_conn_t conns[UPSTREAM_IDLE_MAX];  // 오래된 것부터 (꺼낼 때는 가장 최근 것부터)
+  int n;                  // 들고 있는 연결 수
+  pthread_mutex_t mutex;  // 풀 접근 mutex
+} upstream_pool_t;  // 원 서버 keep-alive 연결 풀
+
+typedef struct {
+  char *host;           // 원 서버 호스트
+  char *port;           // 원 서버 포트
+  int fd;               // 요청을 보낸 연결
+  int http10;           // HTTP/1.0으로 요청 (HTTP/1.1을 처리하지 못하는 원 서버)
+  int reused;           // 풀에서 꺼낸 연결 (원 서버가 이미 닫았을 수 있음)
+  int once;             // 다시 보낼 수 없는 요청 (바디를 흘려 보냈거나 멱등이 아닌 메서드): 풀도 쓰지 않음
+} upstream_t;   // 요청 하나가 쓰는 원 서버 연결
+
+enum {
+  UP_CLOSE,             // 연결을 닫음 (응답 끝을 연결 종료로 알았거나 에러)
+  UP_REUSE,             // 응답을 프레이밍대로 다 읽음: 풀에 돌려줌
+  UP_RETRY,             // 응답 헤더를 받지 못함 (아무것도 전달하지 않음): 다시 보낼 수 있음
+};  // 응답을 처리한 뒤 원 서버 연결의 상태
+
+typedef struct {
+  client_req_t req;     // 요청 (hdrs의 소유권을 가짐)
+  cache_node_t *node;   // 신선한 캐시 적중이면 그 노드 (처리 스레드 없이 차례가 오면 바로 전송)
+  int fd[2];            // 응답 파이프 (fd[0]: 연결 스레드가 읽음, fd[1]: 처리 스레드가 씀)
+  int body_fd;          // 요청 바디를 읽을 파이프 (HTTP/2 스트림, 없으면 -1). 처리 스레드가 닫음
+  int close;            // 응답 후 연결을 닫아야 하면 1 (처리 스레드가 파이프를 닫기 전에 기록)
+  int refcnt;           // 참조 수 (연결 스레드 + 처리 스레드)
+} pipelined_t;  // 파이프라인으로 미리 받은 요청 하나 (순서 큐의 원소)
+
+typedef struct {
+  rio_t *rp;            // 읽기 버퍼 (헤더를 읽은 직후)
+  int chunked;          // Transfer-Encoding: chunked
+  http_chunked_t dec;   // chunked 디코딩 상태
+  long remaining;       // Content-Length로 정해진 바디의 남은 바이트 (-1이면 chunked 또는 연결 종료까지)
+} body_reader_t;  // 요청/응답 바디를 프레이밍에 맞게 읽는 상태
+
+typedef struct {
+  uint32_t id;          // 스트림 ID (0이면 빈 자리)
+  pipelined_t *p;       // 요청을 맡긴 캐시 노드 또는 처리 스레드
+
+  int body_fd;          // 요청 바디를 처리 스레드에 넘기는 파이프 (논블로킹, 없거나 다 넘겼으면 -1)
+  int chunked;          // 길이 없이 온 바디: chunked로 감싸서 넘김
+  int in_end;           // 클라이언트가 요청을 끝냄 (END_STREAM)
+  char *in;             // 파이프에 아직 쓰지 못한 요청 바디
+  size_t in_len, in_cap;
+  uint32_t in_unacked;  // 받았지만 WINDOW_UPDATE로 돌려주지 않은 바이트 (in을 다 넘기면 돌려줌)
+  long recv_window;     // 클라이언트가 이 스트림에 더 보낼 수 있는 바이트 (넘으면 FLOW_CONTROL_ERROR)
+
+  char *buf;            // 처리 스레드가 쓴 HTTP/1.x 응답을 읽어 두는 버퍼 (H2_STREAM_BUF)
+  size_t len;           // buf에 든 바이트
+  const char *data;     // 아직 DATA 프레임으로 보내지 않은 바디 (buf 안 또는 캐시 노드의 바디)
+  size_t dlen;
+  int headers_sent;     // HEADERS 프레임을 보냄
+  int eof;              // 응답을 끝까지 읽음
+  long window;          // 스트림 송신 윈도 (음수가 될 수 있음)
+} h2_stream_t;  // HTTP/2 스트림 하나 (요청 하나)
+
+typedef struct {
+  int fd;                           // 클라이언트 소켓 (논블로킹)
+  h2_stream_t s[PIPELINE_MAX];      // 열린 스트림
+  int nstreams;                     // 열린 스트림 수
+  uint32_t last_id;                 // 마지막으로 받은 스트림 ID (GOAWAY에 씀)
+  hpack_table_t hpack;              // 요청 헤더 디코더의 동적 테이블
+  unsigned char in[H2_FRAME_HEADER + H2_MAX_FRAME];  // 받은 프레임 (완성되지 않은 프레임은 앞에 남김)
+  size_t in_len;
+  rio_out_t out;                    // 보낼 프레임 (h2_queue가 쌓고 h2_flush가 rio_flush_nb로 한 번에 씀)
+  int out_err;                      // 송신 큐를 늘리지 못함: 연결을 닫음
+  unsigned char *block;             // CONTINUATION으로 이어지는 헤더 블록을 모으는 버퍼 (H2_HEADER_LIST)
+  size_t block_len;
+  uint32_t block_stream;            // 헤더 블록을 받는 중인 스트림 (0이면 없음)
+  int block_flags;                  // 그 블록의 HEADERS 플래그
+  long window;                      // 연결 송신 윈도
+  long recv_window;                 // 클라이언트가 연결 전체에 더 보낼 수 있는 바이트 (넘으면 GOAWAY)
+  long init_window;                 // 클라이언트가 정한 스트림 초기 윈도
+  int goaway;                       // 클라이언트가 GOAWAY를 보냄 (새 스트림을 받지 않음)
+} h2_conn_t;  // HTTP/2 연결 하나의 상태 (연결 스레드 혼자 씀)
+
+typedef struct {
+  char *buf;            // 디코딩한 헤더 "이름\0값\0"의 나열
+  size_t len, cap;
+  size_t size;          // 헤더 목록 크기 (RFC 9113: 이름 + 값 + 32의 합)
+  int bad;              // 이름에 대문자나 제어 문자, 값에 NUL/CR/LF가 있음
+} h2_fields_t;  // 요청 헤더 블록을 디코딩한 결과
+
 void *thread(void *vargp);
 int parse_uri(char *uri, char*host, char *port, char *path);
 void func(int connfd);
+int serve_request(int outfd, client_req_t *creq, rio_t *client_rp);  // 요청 하나를 처리해 outfd로 응답 (client_rp가 NULL이면 파이프라인, 연결을 닫아야 하면 1)
+void serve_from_origin(int connfd, const char *uri_key, char *host, char *port, char *path,
+                       const char *hdrs, const char *range, cache_node_t *stale);  // 원 서버에서 가져와 전송 및 캐시
+void forward_request(int connfd, client_req_t *creq, rio_t *client_rp, char *host, char *port,
+                     const char *path);  // GET 외 메서드: 요청 바디를 흘려 보내고 응답을 캐시 없이 전달
+void build_request(char *req, const char *method, const char *path, const char *host, const char *hdrs,
+                   const char *extra, int http10); // 원 서버로 보낼 요청 생성 (http10이면 HTTP/1.0, Connection: close)
+int connect_origin(int connfd, char *host, char *port, cache_node_t *stale, const char *range);  // 원 서버 연결 (실패 시 에러 또는 stale 전송 후 -1)
+void send_error(int connfd, char *errnum, char *shortmsg, char *longmsg);  // 클라이언트에게 에러 응답 전송
+void send_stats(int connfd);  // 프록시 통계 응답 전송 ("GET /stats")
+void origin_failed(int connfd, cache_node_t *stale, const char *range, char *longmsg);  // 원 서버 실패 시 502 또는 stale 전송
+int line_header_id(const char *line, size_t len);  // "이름: 값" 줄의 헤더 ID (HTTP_H_*)
+int is_hop_header(int id);  // 캐시에 저장하지 않을 연결 관련 헤더인지 확인
+int read_request_head(rio_t *rp, http_req_t *req, int wait);  // 요청 헤더 블록을 읽고 파싱 (헤더 길이, 0: EOF/에러, HTTP_PARSE_ERROR, REQ_PENDING)
+int read_client_request(rio_t *rp, client_req_t *creq, int wait);  // 요청을 읽어 creq에 복사 (1: 요청 또는 에러 상태, 0: EOF/에러, REQ_PENDING)
+int has_token(const char *value, size_t len, const char *token);  // 쉼표로 구분된 헤더 값에 토큰이 있는지 (대소문자 무시)
+const char *conn_header(void);  // 현재 응답에 붙일 Connection 헤더 줄
+void drain_client(int connfd);  // 에러 응답 후 읽지 않은 요청을 버려 RST로 응답이 사라지지 않게 함
+int needs_client(const client_req_t *creq);  // 요청 바디나 터널처럼 클라이언트 소켓을 직접 읽어야 하는 요청인지
+
+// 터널 함수
+void open_tunnel(int connfd, client_req_t *creq, rio_t *client_rp);  // CONNECT: 원 서버에 연결한 뒤 연결이 끝날 때까지 중계
+long tunnel_relay(int fd1, int fd2);  // 두 소켓 사이를 splice로 양방향 중계 (옮긴 바이트 수 반환)
+
+// 파이프라이닝 함수
+pipelined_t *pipeline_dispatch(client_req_t *creq, int body_fd);  // 요청을 캐시 노드 또는 처리 스레드에 맡김 (실패하면 NULL, 스레드가 모두 바쁘면 errno = EBUSY)
+void pipeline_job(void *vargp);                      // 요청 하나를 처리해 응답을 파이프에 씀 (pipeline_pool에서 실행)
+int forward_pipelined(int connfd, pipelined_t *p);   // 차례가 온 응답을 클라이언트에 전달 (닫아야 하면 1, 쓰기 실패 시 -1)
+void release_pipelined(pipelined_t *p);              // 참조 해제 (마지막 참조라면 메모리 해제)
+
+// HTTP/2 함수
+int is_h2_preface(rio_t *rp);           // 연결 서문이 HTTP/2(h2c)인지 (앞부분이 다르면 더 기다리지 않고 0)
+void h2_serve(int connfd, rio_t *rp);   // HTTP/2 연결: 스트림마다 요청을 캐시나 처리 스레드에 맡기고 응답을 프레임으로 섞어 보냄
+
+// 설정 함수
+void load_config(const char *path);   // 설정 파일 읽기 ("키 값" 형식, #은 주석)
+int set_sock_profile(sock_profile_t *prof, const char *name);                 // 이름으로 프로파일 적용 (default, latency, bulk)
+int set_sock_option(sock_profile_t *prof, const char *opt, const char *value);  // 프로파일의 개별 옵션 변경
+
+// 소켓 옵션 함수
+void tune_listener(int listenfd);     // 리스너에 listen 프로파일 적용 (accept된 소켓이 상속)
+void tune_upstream(int fd);           // connect 직전 원 서버 소켓에 upstream 프로파일 적용
+void set_cork(int fd, int on);        // TCP_CORK 켜기/끄기 (끌 때 모인 데이터 전송)
+
+// 캐시 키 정규화 함수
+int normalize_uri(const char *uri, char *key, size_t keylen);  // URI를 정규화된 캐시 키로 변환
 
 // 스레드 풀 함수
 void sbuf_init(sbuf_t *sp, int n);        // 큐 초기화
 void sbuf_insert(sbuf_t *sp, int item);   // connfd 저장 (enqueue)
+void sbuf_insert_batch(sbuf_t *sp, int *items, int n);  // connfd 여러 개를 한 번의 잠금으로 저장
 int sbuf_remove(sbuf_t *sp);              // connfd 꺼내기 (dequeue)
+void pool_init(pool_t *pp, int nthreads, int n);            // 작업 큐 초기화 및 스레드 생성
+int pool_submit(pool_t *pp, void (*fn)(void *), void *arg); // 작업 추가 (큐가 가득 차면 0 반환)
+void *pool_thread(void *vargp);                             // 작업을 꺼내 실행하는 스레드
 
 // 캐시 함수
 void cache_init(cache_t *cache);  // 캐시 초기화
-int find_cache_and_send(int connfd, cache_t *cache, const char *uri);  // 캐시 검색 및 적중 시 전송
-void insert_cache(cache_t *cache, const char *uri, const char *data, int size); // 캐시에 새 노드 삽입
+int find_cache_and_send(int connfd, cache_t *cache, const char *uri, const char *range,
+                        cache_node_t **stale);  // 캐시 검색 및 적중 시 전송 (stale-if-error용 노드는 stale로 반환)
+cache_node_t *lookup_cache(cache_t *cache, const char *uri);  // 캐시 검색 (만료된 노드 포함, 적중 시 참조 수 증가 후 반환)
+void release_cache(cache_node_t *node);                       // 참조 해제 (마지막 참조라면 메모리 해제)
+int send_cached(int connfd, cache_node_t *node, const char *range);  // 저장된 헤더 + Age 등 헤더 + 바디(또는 범위)를 writev로 전송 (실패하면 resp_state.close를 세우고 -1)
+int send_zerocopy(int connfd, struct iovec *iov, int iovcnt);         // MSG_ZEROCOPY로 전송 후 커널이 버퍼를 다 쓸 때까지 대기
+cache_node_t *insert_cache(cache_t *cache, const char *uri, const resp_info_t *info, const char *hdr, int hdr_size,
+                           const char *data, int data_size); // 캐시에 새 노드 삽입(같은 키는 교체) 후 참조해서 반환
+void schedule_refresh(cache_node_t *node);  // 만료된 노드의 백그라운드 갱신 예약 (키당 하나)
+void refresh_entry(void *vargp);            // 원 서버에서 새 응답을 받아 캐시 노드 교체
 void evict_cache(cache_t *cache); // 캐시 마지막 노드 제거
+void unlink_cache(cache_t *cache, cache_node_t *node); // 리스트에서 노드 분리 및 참조 해제
+void invalidate_cache(cache_t *cache, const char *uri);  // 키에 해당하는 노드 제거 (안전하지 않은 메서드가 대상을 바꿨을 때)
+
+// gzip 함수
+int accepts_gzip(const char *value, size_t len);  // Accept-Encoding 값이 gzip을 허용하는지 (q=0이면 거부)
+int is_compressible_type(const char *value);     // 압축할 Content-Type인지 (text/*, JSON, JavaScript, XML, SVG)
+int gzip_key(const char *uri_key, char *key);    // gzip 변형의 캐시 키 (MAXLINE을 넘으면 -1)
+int gzip_header(const char *hdr, int size, char *out, long length);  // 원본 헤더를 gzip 변형의 헤더로 (out에 size + 128바이트 필요)
+cache_node_t *gzip_variant(const char *uri_key, int make);  // 신선한 gzip 변형 (make면 원본 노드를 압축해 만듦, 참조해서 반환)
+
+// 원 서버 응답 처리 함수
+int relay_response(int connfd, upstream_t *up, const char *uri_key, int cache_ok,
+                   cache_node_t *stale);  // 응답을 클라이언트로 전달하며 캐시 (cache_ok 0이면 저장 안 함). UP_* 반환
+cache_node_t *fetch_into_cache(upstream_t *up, const char *uri_key, cache_node_t *stale,
+                               int *result);  // 응답 전체를 캐시에 저장 후 참조해서 반환 (너무 크면 NULL). 연결 상태는 result에
+int parse_range(const char *line, long size, long *first, long *last);  // Range 헤더 해석
+void body_init(body_reader_t *b, rio_t *rp, int chunked, long length);  // 바디 읽기 준비 (length -1: 연결 종료까지)
+ssize_t read_body(body_reader_t *b, char *raw, size_t cap, char *out,
+                  size_t *outlen);  // 바디 한 조각 읽기: 원본은 raw에, 데이터는 out에 (out == raw 가능, NULL이면 원본만). 원본 바이트 수, 0: 끝, -1: 에러
+int write_chunk(int fd, const char *data, size_t n);  // chunked로 한 조각 전송 (n이 0이면 마지막 chunk)
+
+// 원 서버 연결 풀 함수
+int open_upstream(int connfd, upstream_t *up, const char *req, cache_node_t *stale,
+                  const char *range);  // 유휴 연결 또는 새 연결로 요청 전송 (실패 시 에러 또는 stale 전송 후 -1)
+int finish_upstream(upstream_t *up, int result);  // 응답 처리 결과(UP_*)에 따라 연결을 풀에 돌려주거나 닫음 (다시 보내야 하면 1)
+int upstream_get(const char *host, const char *port);          // 원 서버의 유휴 연결 꺼내기 (없으면 -1)
+void upstream_put(const char *host, const char *port, int fd); // 유휴 연결 돌려주기 (풀이 가득 차면 가장 오래된 연결을 닫음)
+
+// 네거티브 캐시 함수
+int neg_lookup(const char *host, const char *port);               // 기억된 원 서버 실패 종류 조회 (없으면 NEG_NONE)
+void neg_insert(const char *host, const char *port, int kind);    // 원 서버 실패 기록
 
 /* You won't lose style points for including this long line in your code */
-static const char *user_agent_hdr =
-    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
-    "Firefox/10.0.3\r\n";
+static const char *user_agent =
+    "Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
+    "Firefox/10.0.3";
 
 sbuf_t sbuf;
+unsigned long accept_batches;   // 리스너가 깨어나 연결을 받은 횟수
+unsigned long accept_conns;     // 받은 연결 수 (accept_conns / accept_batches = 평균 배치 크기)
+unsigned long accept_batch_max; // 가장 큰 배치 크기
+unsigned long zc_sends;         // MSG_ZEROCOPY로 보낸 응답 수
+unsigned long zc_copied;        // 커널이 결국 복사로 처리한 완료 알림 수 (루프백 등)
+unsigned long zc_aborted;       // 완료 알림을 기다리다 끊은 연결 수
+int zc_disabled;                // SO_ZEROCOPY를 지원하지 않는 커널이면 1
+unsigned long keepalive_reuses; // keep-alive로 같은 연결에서 받은 두 번째 이후 요청 수
+unsigned long pipeline_requests;  // 앞선 응답이 끝나기 전에 받아 동시에 처리한 요청 수
+unsigned long pipeline_hits;      // 그중 처리 스레드 없이 캐시에서 바로 응답한 요청 수
+unsigned long pipeline_inline;    // 처리 스레드가 모두 바빠 연결 스레드가 차례로 처리한 요청 수 (HTTP/2는 거절)
+unsigned long pipeline_depth_max; // 한 연결에서 동시에 처리한 최대 요청 수
+unsigned long tunnel_opened;    // CONNECT로 연 터널 수
+unsigned long tunnel_bytes;     // 터널로 중계한 바이트 수 (양방향 합)
+unsigned long upstream_reuses;  // 풀의 유휴 연결로 보낸 요청 수
+unsigned long upstream_fallbacks; // HTTP/1.1 요청을 거부해 HTTP/1.0으로 되돌린 횟수
+unsigned long h2_conns;         // HTTP/2로 처리한 연결 수
+unsigned long h2_streams;       // HTTP/2 연결에서 받은 요청(스트림) 수
+unsigned long gzip_streamed;    // 원 서버 응답을 받으면서 압축해 보낸 응답 수
+unsigned long gzip_variants;    // 캐시된 원본을 압축해 만든 gzip 변형 수
+unsigned long gzip_in;          // 압축 전 바이트 합
+unsigned long gzip_out;         // 압축 후 바이트 합
+static __thread resp_state_t resp_state;  // 스레드마다 하나 (요청을 처리할 때마다 초기화)
+pool_t refresh_pool;
+pool_t pipeline_pool;
 cache_t cache;
+neg_cache_t neg_cache;
+upstream_pool_t upstream_pool;
+config_t config = {
+  .neg_ttl_dns = NEG_TTL_DNS,
+  .neg_ttl_connect = NEG_TTL_CONNECT,
+  .neg_ttl_status = NEG_TTL_STATUS,
+  .cache_default_ttl = CACHE_DEFAULT_TTL,
+  .cache_swr = CACHE_SWR,
+  .cache_sie = CACHE_SIE,
+  .refresh_threads = REFRESH_THREADS,
+  .dns_ttl = DNS_TTL,
+  .dns_neg_ttl = DNS_NEG_TTL,
+  .dns_refresh_ahead = DNS_REFRESH_AHEAD,
+  .connect_timeout = CONNECT_TIMEOUT,
+  .connect_delay = CONNECT_DELAY,
+  .timeout_header = TIMEOUT_HEADER,
+  .timeout_first_byte = TIMEOUT_FIRST_BYTE,
+  .timeout_idle = TIMEOUT_IDLE,
+  .timeout_transfer = TIMEOUT_TRANSFER,
+  .zerocopy_min = ZEROCOPY_MIN,
+  .keepalive_timeout = KEEPALIVE_TIMEOUT,
+  .keepalive_requests = KEEPALIVE_REQUESTS,
+  .pipeline_depth = PIPELINE_DEPTH,
+  .pipeline_threads = PIPELINE_THREADS,
+  .upstream_keepalive = UPSTREAM_KEEPALIVE,
+  .upstream_idle_max = UPSTREAM_IDLE_MAX,
+  .upstream_fallback_ttl = UPSTREAM_FALLBACK_TTL,
+  .h2c = 1,
+  .gzip = 1,
+  .gzip_min = GZIP_MIN,
+  .gzip_level = GZIP_LEVEL,
+};
 
 int main(int argc, char **argv) {
-  int listenfd, connfd;
+  int listenfd, connfd, batch[ACCEPT_BATCH];
   socklen_t clientlen;
   struct sockaddr_storage clientaddr;
 
   /* Check command line args */
-  if (argc != 2)
+  if (argc != 2 && argc != 3)
   {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    fprintf(stderr, "usage: %s <port> [config]\n", argv[0]);
     exit(1);
   }
+  hdr_rule_add(HDR_REQUEST, "*", "replace", "User-Agent", user_agent);  // 기본 규칙 (설정 파일 규칙이 뒤에 오므로 덮어쓸 수 있음)
+  if (argc == 3) {
+    load_config(argv[2]); // 설정 파일이 주어진 경우에만 읽음
+  }
+  hdr_rules_compile();  // 헤더 재작성 규칙을 원 서버별 테이블로 컴파일
 
+  Signal(SIGPIPE, SIG_IGN); // 끊어진 소켓에 쓰면 프로세스가 종료되지 않고 EPIPE를 반환하도록 함
   sbuf_init(&sbuf, SBUFSIZE); // 작업 큐 초기화
   cache_init(&cache); // 캐시 초기화
+  pthread_mutex_init(&neg_cache.mutex, NULL); // 네거티브 캐시 초기화
+  pthread_mutex_init(&upstream_pool.mutex, NULL); // 원 서버 연결 풀 초기화
+  pool_init(&refresh_pool, config.refresh_threads, REFRESH_QUEUE); // 백그라운드 갱신 스레드 생성
+  pool_init(&pipeline_pool, config.pipeline_threads, PIPELINE_QUEUE); // 파이프라이닝 처리 스레드 생성
+  dns_cache_init(config.dns_ttl, config.dns_neg_ttl, config.dns_refresh_ahead); // DNS 캐시 초기화
+  open_clientfd_config(config.connect_timeout, config.connect_delay);            // 병렬 연결 시간 설정
+  timeout_init(); // 제한 시간이 지난 연결을 끊는 reaper 스레드 생성
+  open_clientfd_setup(tune_upstream); // 원 서버 소켓 옵션
 
   // 워커 스레드 생성
   pthread_t tid;
@@ -80,255 +514,3111 @@ int main(int argc, char **argv) {
   }
 
   // 메인 스레드: 클라이언트 연결 수락 및 큐에 삽입
+  //    리스너를 논블로킹으로 두고, 깨어날 때마다 대기 중인 연결을 EAGAIN까지 모두 받아 한 번에 큐에 넣음
   listenfd = Open_listenfd(argv[1]);
+  tune_listener(listenfd);
+  fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+  struct pollfd pfd = {.fd = listenfd, .events = POLLIN};
   while (1) {
-    clientlen = sizeof(clientaddr);
-    connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
-    sbuf_insert(&sbuf, connfd); // connfd를 큐에 삽입
+    if (poll(&pfd, 1, -1) < 0) continue;  // EINTR
+
+    int n = 0;
+    while (n < ACCEPT_BATCH) {
+      clientlen = sizeof(clientaddr);
+      // 워커는 블로킹 I/O를 쓰므로 연결 소켓에는 SOCK_NONBLOCK을 주지 않음
+      connfd = accept4(listenfd, (SA *)&clientaddr, &clientlen, SOCK_CLOEXEC);
+      if (connfd < 0) {
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {  // ECONNABORTED, EMFILE 등은 해당 연결만 포기
+          fprintf(stderr, "accept 실패: %s\n", strerror(errno));
+        }
+        break;
+      }
+      batch[n++] = connfd;
+    }
+    if (n == 0) continue;
+
+    sbuf_insert_batch(&sbuf, batch, n); // 배치 전체를 한 번에 큐에 삽입
+    __atomic_add_fetch(&accept_batches, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&accept_conns, n, __ATOMIC_RELAXED);
+    if (n > accept_batch_max) __atomic_store_n(&accept_batch_max, n, __ATOMIC_RELAXED);
   }
 
   return 0;
 }
 
 void func(int connfd) {
-  rio_t client_rio, server_rio;
-  char buf[MAXLINE], req[MAX_OBJECT_SIZE];
-  char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
-  char host[MAXLINE], port[10], path[MAXLINE];
+  rio_t client_rio;
+  client_req_t creq, held;  // held: 앞선 응답이 끝나기를 기다리는, 클라이언트 소켓을 읽어야 하는 요청
+  pipelined_t *queue[PIPELINE_MAX];  // 요청 순서대로 응답을 내보내는 순서 큐 (원형)
+  int qhead = 0, qlen = 0, served = 0, reading = 1, closing = 0, drain = 0, holding = 0;
+  timeout_t header_to;
 
-  Rio_readinitb(&client_rio, connfd);
-
-  // 1. 요청 라인 읽기
-  if (!Rio_readlineb(&client_rio, buf, MAXLINE)) return;
-  sscanf(buf, "%s %s %s", method, uri, version);
+  rio_readinitb(&client_rio, connfd);
+  while (!closing && (reading || qlen > 0 || holding)) {
+    // 0. 앞선 응답을 다 보냈다면 보류해 둔 요청을 이 스레드에서 처리
+    if (holding && qlen == 0) {
+      closing = serve_request(connfd, &held, &client_rio);
+      free(held.hdrs);
+      holding = 0;
+      continue;
+    }
 
-  // 2. 캐시 검색 및 적중 시 전송 후 작업 종료
-  if (find_cache_and_send(connfd, &cache, uri)) return;
+    // 1. 다음 요청 읽기: 처리 중인 요청이 없으면 도착할 때까지 기다리고, 있으면 이미 도착한 바이트만 파싱
+    //    요청 헤더를 제한 시간 안에 다 보내지 않거나 keep-alive 연결에서 너무 오래 쉬는 클라이언트는 reaper가 끊음
+    //    요청 바디 뒤의 바이트는 바디를 다 읽기 전까지 다음 요청으로 해석할 수 없으므로 보류 중에는 읽지 않음
+    if (reading && !holding && qlen < config.pipeline_depth) {
+      int wait = qlen == 0;
+      if (wait) {
+        timeout_start(&header_to, served ? TO_KEEPALIVE : TO_HEADER,
+                      (served ? config.keepalive_timeout : config.timeout_header) * 1000, connfd, -1);
+      }
+      // 첫 요청 대신 HTTP/2 연결 서문이 오면 이 연결은 HTTP/2 프레임으로 처리
+      if (!served && config.h2c && is_h2_preface(&client_rio)) {
+        if (timeout_cancel(&header_to)) break;
+        h2_serve(connfd, &client_rio);
+        return;
+      }
+      int rc = read_client_request(&client_rio, &creq, wait);
+      if (wait && timeout_cancel(&header_to)) {
+        if (!served) fprintf(stderr, "요청 헤더 읽기 제한 시간 초과\n");
+        if (rc > 0) free(creq.hdrs);
+        break;
+      }
+      if (rc == 0) {  // EOF 또는 에러: 이미 받은 요청의 응답은 마저 보냄
+        reading = 0;
+        continue;
+      }
+      if (rc > 0) {
+        if (served++ > 0) __atomic_add_fetch(&keepalive_reuses, 1, __ATOMIC_RELAXED);
+        if (!creq.keep_alive || served >= config.keepalive_requests) reading = 0;  // 이 요청이 마지막
+        if (creq.status) drain = 1;  // 형식 오류: 남은 바이트는 요청으로 해석할 수 없음
 
-  // 3. URI 파싱 (호출 전 캐시 삽입용 URI 원본 복사)
-  char uri_key[MAXLINE];
-  strcpy(uri_key, uri);
-  if (parse_uri(uri, host, port, path) == -1) {
-      fprintf(stderr, "올바른 URI가 아닙니다: %s\n", uri);
-      return;
-  }
+        // 2. 뒤따르는 요청이 없거나 요청 바디를 읽어야 한다면 이 스레드에서 클라이언트 소켓에 바로 응답
+        if (qlen == 0 && (!reading || client_rio.rio_cnt <= 0 || needs_client(&creq))) {
+          closing = serve_request(connfd, &creq, &client_rio);
+          free(creq.hdrs);
+          continue;
+        }
+        if (needs_client(&creq)) {
+          held = creq;
+          holding = 1;
+          continue;
+        }
 
-  // 4. 요청 헤더 재작성
-  sprintf(req, "GET %s HTTP/1.0\r\n", path);
-  while (Rio_readlineb(&client_rio, buf, MAXLINE) > 0 && strcmp(buf, "\r\n") != 0) {
-      if (strncasecmp(buf, "Host", 4) == 0 ||
-          strncasecmp(buf, "User-Agent", 10) == 0 ||
-          strncasecmp(buf, "Connection", 10) == 0 ||
-          strncasecmp(buf, "Proxy-Connection", 16) == 0) {
+        // 3. 파이프라이닝: 캐시 적중은 노드만 잡아 두고, 나머지는 처리 스레드가 동시에 원 서버에서 가져옴
+        pipelined_t *p = pipeline_dispatch(&creq, -1);
+        if (p == NULL && errno == EBUSY) {  // 처리 스레드가 모두 바쁨: 앞선 응답을 다 보낸 뒤 이 스레드에서 처리
+          __atomic_add_fetch(&pipeline_inline, 1, __ATOMIC_RELAXED);
+          held = creq;
+          holding = 1;
           continue;
+        }
+        if (p == NULL) {  // 이 요청은 응답하지 못하므로 앞선 응답까지만 보내고 닫음 (클라이언트가 재시도)
+          free(creq.hdrs);
+          reading = 0;
+          continue;
+        }
+        queue[(qhead + qlen++) % PIPELINE_MAX] = p;
+        __atomic_add_fetch(&pipeline_requests, 1, __ATOMIC_RELAXED);
+        if (qlen > pipeline_depth_max) __atomic_store_n(&pipeline_depth_max, qlen, __ATOMIC_RELAXED);
+        continue;
       }
-      strcat(req, buf);  // 유효한 헤더는 저장
+      // REQ_PENDING: 다음 요청이 아직 다 오지 않았으므로 앞선 응답부터 보냄
+    }
+
+    // 4. 가장 오래된 요청의 응답을 클라이언트에 전달 (응답 순서 = 요청 순서)
+    pipelined_t *p = queue[qhead];
+    qhead = (qhead + 1) % PIPELINE_MAX;
+    qlen--;
+    if (forward_pipelined(connfd, p) != 0) closing = 1;
+    if (p->fd[0] >= 0) close(p->fd[0]);
+    release_pipelined(p);
   }
-  // 표준 헤더 추가
-  sprintf(buf, "Host: %s\r\n", host); strcat(req, buf);
-  sprintf(buf, "%s", user_agent_hdr); strcat(req, buf);
-  sprintf(buf, "Connection: close\r\n"); strcat(req, buf);
-  sprintf(buf, "Proxy-Connection: close\r\n\r\n"); strcat(req, buf);
-  printf("최종 요청:\n%s\n", req);
 
-  // 5. 원 서버에 요청
-  int serverfd = Open_clientfd(host, port);
-  if (serverfd < 0) {
-      fprintf(stderr, "원 서버 연결 실패\n");
-      return;
+  // 연결을 닫기 전에 남은 요청은 버림 (처리 스레드는 닫힌 파이프에 쓰다 EPIPE로 끝남)
+  if (holding) free(held.hdrs);
+  while (qlen > 0) {
+    if (queue[qhead]->fd[0] >= 0) close(queue[qhead]->fd[0]);
+    release_pipelined(queue[qhead]);
+    qhead = (qhead + 1) % PIPELINE_MAX;
+    qlen--;
   }
+  if (drain || client_rio.rio_cnt > 0) {
+    drain_client(connfd);  // 읽지 않은 요청이 남아 있으면 RST로 마지막 응답이 사라질 수 있음
+  }
+}
 
-  Rio_readinitb(&server_rio, serverfd);
-  Rio_writen(serverfd, req, strlen(req)); // 요청 전체 전송
+int serve_request(int outfd, client_req_t *creq, rio_t *client_rp) {
+  char host[MAXLINE], port[10], path[MAXLINE], uri_key[MAXLINE];
+  cache_node_t *stale = NULL;
+  timeout_t transfer_to;
 
-  // 6. 응답 수신 + 클라이언트로 전송 + 캐싱 준비
-  int n;
-  int total_size = 0;
-  char *object_buf = Malloc(MAX_OBJECT_SIZE);
-  char *p = object_buf;
+  resp_state.keep_alive = creq->keep_alive;
+  resp_state.close = 0;
+  resp_state.sock = client_rp != NULL && client_rp->rio_fd == outfd;  // HTTP/2 스트림은 바디를 파이프에서 읽음
+  resp_state.chunked_ok = creq->chunked_ok;
+  resp_state.chunked = 0;
+  resp_state.head = strcmp(creq->method, "HEAD") == 0;
+  resp_state.gzip_ok = 0;
+  resp_state.gzip = 0;
 
-  // 응답 헤더 전송
-  while ((n = Rio_readlineb(&server_rio, buf, MAXLINE)) > 0) {
-    Rio_writen(connfd, buf, n);
-    if (total_size + n < MAX_OBJECT_SIZE) {
-      memcpy(p, buf, n);
-      p += n;
-      total_size += n;
-    }
-    if (strcmp(buf, "\r\n") == 0) break; // 요청 끝 감지
+  // 요청 헤더를 읽다가 발견한 형식 오류 또는 너무 큰 헤더
+  switch (creq->status) {
+  case 0:
+      break;
+  case 414:
+      send_error(outfd, "414", "URI Too Long", "Request URI is too long");
+      return 1;
+  case 431:
+      send_error(outfd, "431", "Request Header Fields Too Large", "Request header is too large");
+      return 1;
+  case 501:
+      send_error(outfd, "501", "Not Implemented", "Proxy doesn't support this method or transfer coding");
+      return 1;
+  case 505:
+      send_error(outfd, "505", "HTTP Version Not Supported", "Only HTTP/1.x is supported");
+      return 1;
+  default:
+      send_error(outfd, "400", "Bad Request", "Proxy couldn't parse the request");
+      return 1;
   }
 
-  // 응답 바디 전송
-  while ((n = Rio_readnb(&server_rio, buf, MAXBUF)) > 0) {
-    Rio_writen(connfd, buf, n);
-    if (total_size + n < MAX_OBJECT_SIZE) {
-      memcpy(p, buf, n);
-      p += n;
-      total_size += n;
-    }
+  // CONNECT: 터널은 연결이 끝날 때까지 이어지므로 전송 제한 시간 없이 무응답 제한만 둠
+  if (creq->tunnel) {
+      open_tunnel(outfd, creq, client_rp);
+      return 1;
   }
 
-  // 7. 캐시 저장 (크기 조건 만족 시)
-  if (total_size <= MAX_OBJECT_SIZE) {
-    insert_cache(&cache, uri_key, object_buf, total_size);
+  // 프록시 자신에게 온 통계 요청 (절대 URI가 아닌 "/stats")
+  if (strcmp(creq->uri, "/stats") == 0) {
+      send_stats(outfd);
+      return !resp_state.keep_alive;
   }
 
-  free(object_buf);
-  Close(serverfd);
+  // 1. 캐시 키 정규화 후 캐시 검색, 적중 시 (범위 요청이라면 해당 범위만) 전송 후 작업 종료
+  //    만료됐지만 stale-if-error 기간인 노드는 원 서버 실패 시 대신 보내기 위해 stale로 받아 둠
+  if (normalize_uri(creq->uri, uri_key, sizeof(uri_key)) == -1 || parse_uri(creq->uri, host, port, path) == -1) {
+      fprintf(stderr, "올바른 URI가 아닙니다: %s\n", creq->uri);
+      resp_state.close = 1;  // 응답 없이 다음 요청으로 넘어가면 클라이언트가 응답 짝을 잃음
+      send_error(outfd, "400", "Bad Request", "Proxy couldn't parse the request URI");
+      return 1;
+  }
+  timeout_start(&transfer_to, TO_TRANSFER, config.timeout_transfer * 1000, outfd, -1);  // 느린 클라이언트로의 전송 제한
+  if (strcmp(creq->method, "GET") != 0) {
+      // GET 외 메서드는 캐시를 거치지 않고 그대로 전달
+      // 안전하지 않은 메서드는 대상을 바꿨을 수 있으므로 응답 후 같은 키의 캐시를 버림 (RFC 9111 4.4)
+      forward_request(outfd, creq, client_rp, host, port, path);
+      if (!resp_state.head && strcmp(creq->method, "OPTIONS") != 0 && strcmp(creq->method, "TRACE") != 0) {
+          char gz_uri[MAXLINE];
+          invalidate_cache(&cache, uri_key);
+          if (gzip_key(uri_key, gz_uri) == 0) invalidate_cache(&cache, gz_uri);
+      }
+  } else {
+      // gzip을 받는 클라이언트의 전체 요청: 압축 변형이 있거나 신선한 원본으로 만들 수 있으면 그것을 보냄
+      resp_state.gzip_ok = creq->gzip_ok && creq->range[0] == '\0';
+      cache_node_t *gz = resp_state.gzip_ok ? gzip_variant(uri_key, 1) : NULL;
+      if (gz) {
+          send_cached(outfd, gz, NULL);
+          release_cache(gz);
+      } else if (!find_cache_and_send(outfd, &cache, uri_key, creq->range, &stale)) {
+          // 2. 원 서버에서 가져와 전송 (gzip_ok면 받으면서 압축)
+          serve_from_origin(outfd, uri_key, host, port, path, creq->hdrs, creq->range, stale);
+          if (stale) {
+              release_cache(stale);
+          }
+      }
+  }
+  if (timeout_cancel(&transfer_to)) resp_state.close = 1;  // 응답이 중간에 잘렸을 수 있음
+  return !resp_state.keep_alive || resp_state.close;
 }
 
-int parse_uri(char *uri, char*host, char *port, char *path) {
-  // "http://www.example.com:8000/index.html"
-  char *hostbegin, *hostend, *pathbegin, *portbegin;
+void serve_from_origin(int connfd, const char *uri_key, char *host, char *port, char *path,
+                       const char *hdrs, const char *range, cache_node_t *stale) {
+  char req[MAX_OBJECT_SIZE];
+  upstream_t up = {.host = host, .port = port, .http10 = neg_lookup(host, port) == NEG_HTTP10};
+  cache_node_t *node = NULL;
+  timeout_t transfer_to;
+  int rc;
 
-  if (strncasecmp(uri, "http://", 7) != 0) {  // 대소문자 구분 없이 접두어 확인
-    return -1;
-  }
-  // 파일 경로 찾기
-  hostbegin = uri + 7;  // http:// 이후부터 시작
-  pathbegin = strchr(hostbegin, '/'); 
-  if (pathbegin) {  // '/'가 있다면
-    strcpy(path, pathbegin);  // 경로에 이후 내용(파일 경로)을 저장
-    *pathbegin = '\0';        // '/' 이전 이후로 문자열 분리
-  } else {
-    strcpy(path, "/");        // '/'가 없다면 path에 '/'를 저장
+  // 5. 원 서버에 요청 (유휴 연결이 있으면 재사용)
+  //    범위 요청이라도 일단 Range 없이 전체 객체를 요청해 캐시에 저장한 뒤 캐시에서 범위를 잘라 보냄
+  //    응답 헤더를 받기 전에 실패하면 새 연결 또는 HTTP/1.0으로 다시 보냄
+  do {
+    build_request(req, "GET", path, host, hdrs, NULL, up.http10);
+    printf("최종 요청:\n%s\n", req);
+    if (open_upstream(connfd, &up, req, stale, range) < 0) return;
+    timeout_start(&transfer_to, TO_TRANSFER, config.timeout_transfer * 1000, up.fd, -1);  // 천천히 보내는 원 서버 제한
+    if (range[0] == '\0') {
+      // 6. 응답 수신 + 클라이언트로 전송 + 캐싱
+      rc = relay_response(connfd, &up, uri_key, 1, stale);
+    } else {
+      // 6. 범위 요청: 전체 객체가 캐시 가능한 크기라면 저장 후 캐시에서 범위 전송
+      node = fetch_into_cache(&up, uri_key, stale, &rc);
+    }
+    if (timeout_cancel(&transfer_to)) rc = UP_CLOSE;
+  } while (finish_upstream(&up, rc));
+  if (rc == UP_RETRY) {
+    origin_failed(connfd, stale, range, "Origin didn't send a valid response");
+    return;
   }
-  // 포트 번호 찾기
-  portbegin = strchr(hostbegin, ':');
-  if (portbegin) {  // ':'가 있다면
-    *portbegin = '\0';  // ':'를 기준으로 host시작부를 분리
-    strcpy(host, hostbegin);
-    strcpy(port, portbegin + 1);
-  } else {
-    strcpy(host, hostbegin);  // ':'가 없다면 전부 호스트 문자열
-    strcpy(port, "80"); // 기본 포트 설정
+  if (range[0] == '\0') return;
+  if (node) {
+    send_cached(connfd, node, range);
+    release_cache(node);
+    return;
   }
 
-  return 0;
+  // 7. 객체가 너무 크면 Range 헤더를 그대로 전달해 다시 요청 (206 응답은 캐시하지 않음)
+  do {
+    build_request(req, "GET", path, host, hdrs, range, up.http10);
+    if (open_upstream(connfd, &up, req, stale, range) < 0) return;
+    timeout_start(&transfer_to, TO_TRANSFER, config.timeout_transfer * 1000, up.fd, -1);
+    rc = relay_response(connfd, &up, uri_key, 0, stale);
+    if (timeout_cancel(&transfer_to)) rc = UP_CLOSE;
+  } while (finish_upstream(&up, rc));
+  if (rc == UP_RETRY) {
+    origin_failed(connfd, stale, range, "Origin didn't send a valid response");
+  }
 }
 
-void sbuf_init(sbuf_t *sp, int n) {
-  sp->buf = Calloc(n, sizeof(int));     // connfd 저장용 배열 할당
-  sp->n = n;                            // 버퍼 크기 저장
-  sp->front = sp->rear = 0;             // 초기 인덱스 0
-  pthread_mutex_init(&sp->mutex, NULL); // mutex 초기화
-  pthread_cond_init(&sp->slots, NULL);  // 빈 슬롯 대기 조건 변수 초기화
-  pthread_cond_init(&sp->items, NULL);  // 아이템 대기 조건 변수 초기화
+void forward_request(int connfd, client_req_t *creq, rio_t *client_rp, char *host, char *port,
+                     const char *path) {
+  char req[MAX_OBJECT_SIZE], buf[RELAY_BUFSIZE];
+  upstream_t up = {.host = host, .port = port, .http10 = neg_lookup(host, port) == NEG_HTTP10};
+  body_reader_t body;
+  timeout_t idle_to;
+  ssize_t n = 0;
+  size_t dlen;
+  int rc;
 
-}
+  // 바디를 흘려 보낸 요청과 멱등이 아닌 요청은 원 서버가 처리했는지 알 수 없으므로 다시 보내지 않음
+  // (이미 닫힌 유휴 연결에 보낼 수 있으니 풀도 쓰지 않음)
+  up.once = creq->body_len != 0 || strcmp(creq->method, "POST") == 0 || strcmp(creq->method, "PATCH") == 0;
+  do {
+    // 요청 헤더 (Range도 그대로 전달). chunked 바디는 받은 그대로 흘려 보내므로 항상 HTTP/1.1로 요청
+    build_request(req, creq->method, path, host, creq->hdrs, creq->range, up.http10 && creq->body_len >= 0);
+    printf("최종 요청:\n%s\n", req);
 
-void sbuf_insert(sbuf_t *sp, int item) {
-  pthread_mutex_lock(&sp->mutex);       // 큐 접근 mutext 잠금
+    // 바디를 다 읽기 전에 실패하면 남은 바디가 다음 요청으로 해석되지 않도록 연결을 닫음
+    resp_state.close = creq->body_len != 0;
+    if (open_upstream(connfd, &up, req, NULL, NULL) < 0) return;
 
-  while (((sp->rear + 1) % sp->n) == sp->front) { // 큐가 가득 찬 경우
-    pthread_cond_wait(&sp->slots, &sp->mutex);    // 빈 슬롯이 생길 때까지 대기
+    // 요청 바디를 RELAY_BUFSIZE씩 읽는 대로 원 서버로 보냄 (프레이밍을 따라가므로 바디 뒤의 다음 요청은 읽지 않음)
+    //    100-continue를 기다리는 클라이언트에게는 원 서버 대신 중간 응답을 보내 바디를 받기 시작함
+    //    원 서버가 바디를 다 받기 전에 응답하고 닫았다면 그 응답을 전달
+    if (creq->body_len != 0) {
+      if (creq->expect_continue && creq->chunked_ok && client_rp->rio_cnt <= 0 &&
+          rio_writen(connfd, "HTTP/1.1 100 Continue\r\n\r\n", 25) < 0) {
+        close(up.fd);
+        return;
+      }
+      body_init(&body, client_rp, creq->body_len < 0, creq->body_len);
+      timeout_start(&idle_to, TO_IDLE, config.timeout_idle * 1000, connfd, up.fd);
+      while ((n = read_body(&body, buf, sizeof(buf), NULL, &dlen)) > 0) {
+        timeout_extend(&idle_to, config.timeout_idle * 1000);
+        if (rio_writen(up.fd, buf, n) < 0) break;
+      }
+      if (timeout_cancel(&idle_to)) n = -1;
+      if (n < 0) {
+        close(up.fd);
+        send_error(connfd, "400", "Bad Request", "Proxy couldn't read the request body");
+        return;
+      }
+      resp_state.close = n > 0;  // 바디를 끝까지 읽지 못함
+    }
+
+    // 응답은 저장하지 않고 전달만 함
+    rc = relay_response(connfd, &up, "", 0, NULL);
+    if (n > 0 && rc == UP_REUSE) rc = UP_CLOSE;  // 원 서버가 읽지 않은 바디가 남음
+  } while (finish_upstream(&up, rc));
+  if (rc == UP_RETRY) {
+    origin_failed(connfd, NULL, NULL, "Origin didn't send a valid response");
   }
+}
 
-  sp->buf[sp->rear] = item;           // connfd를 rear 위치에 저장
-  sp->rear = (sp->rear + 1) % sp->n;  // rear 인덱스 증가 (원형 회전)
+void build_request(char *req, const char *method, const char *path, const char *host, const char *hdrs,
+                   const char *extra, int http10) {
+  // 요청 줄 + 클라이언트 헤더(헤더 규칙 적용 후) + 추가 헤더 + 표준 헤더
+  //    HTTP/1.1은 응답 후 연결을 풀에 돌려받기 위해 keep-alive, 되돌린 HTTP/1.0 원 서버에는 매번 새 연결
+  req += sprintf(req, "%s %s HTTP/1.%d\r\n%s%s", method, path, !http10, hdrs, extra ? extra : "");
+  sprintf(req, "Host: %s\r\n%s\r\n", host,
+          http10 ? "Connection: close\r\nProxy-Connection: close\r\n" : "Connection: keep-alive\r\n");
+}
 
-  pthread_cond_signal(&sp->items);    // 대기 중인 워커 스레드에게 작업이 생겼음을 알림
-  pthread_mutex_unlock(&sp->mutex);   // mutex 잠금 해제
+// 원 서버 실패 응답: stale-if-error로 쓸 수 있는 노드가 있다면 에러 대신 그 노드를 전송
+void origin_failed(int connfd, cache_node_t *stale, const char *range, char *longmsg) {
+  if (connfd < 0) return;  // 백그라운드 갱신: 알릴 클라이언트가 없음
+  if (stale) {
+    send_cached(connfd, stale, range);
+  } else {
+    send_error(connfd, "502", "Bad Gateway", longmsg);
+  }
 }
 
-int sbuf_remove(sbuf_t *sp) {
-  pthread_mutex_lock(&sp->mutex); // 큐 접근 잠금
+int connect_origin(int connfd, char *host, char *port, cache_node_t *stale, const char *range) {
+  // 최근 실패한 원 서버라면 연결 시도 없이 바로 에러 응답
+  int kind = neg_lookup(host, port);
+  if (kind == NEG_DNS) {
+      origin_failed(connfd, stale, range, "Proxy couldn't resolve the origin host (cached)");
+      return -1;
+  } else if (kind == NEG_CONNECT) {
+      origin_failed(connfd, stale, range, "Proxy couldn't connect to the origin (cached)");
+      return -1;
+  }
 
-  while (sp->front == sp->rear) { // 큐가 비어있는 경우
-    pthread_cond_wait(&sp->items, &sp->mutex);  // 아이템이 들어올 때까지 대기
+  int serverfd = dns_open_clientfd(host, port);  // DNS 캐시를 거쳐 연결
+  if (serverfd < 0) {
+      fprintf(stderr, "원 서버 연결 실패\n");
+      if (serverfd == -1 && errno == ETIMEDOUT) {
+          timeout_count(TO_CONNECT);  // connect_timeout 안에 어느 주소와도 연결하지 못함
+      }
+      if (serverfd == -2) {  // getaddrinfo 실패
+          neg_insert(host, port, NEG_DNS);
+          origin_failed(connfd, stale, range, "Proxy couldn't resolve the origin host");
+      } else {
+          neg_insert(host, port, NEG_CONNECT);
+          origin_failed(connfd, stale, range, "Proxy couldn't connect to the origin");
+      }
+      return -1;
   }
+  return serverfd;
+}
 
-  int item = sp->buf[sp->front];        // front 위치의 connfd 가져오기
-  sp->front = (sp->front + 1) % sp->n;  // front 인덱스 증가 (원형 회전)
+// Cache-Control 헤더 값에서 공유 캐시에 필요한 지시어만 해석
+static void parse_cache_control(const char *value, resp_info_t *info) {
+  char directives[MAXLINE], *save, *d;
 
-  pthread_cond_signal(&sp->slots);      // 대기 중인 메인 스레드에게 공간이 생겼음을 알림
-  pthread_mutex_unlock(&sp->mutex);     // 잠금 해제
+  snprintf(directives, sizeof(directives), "%s", value);
+  for (d = strtok_r(directives, ", \t\r\n", &save); d; d = strtok_r(NULL, ", \t\r\n", &save)) {
+    if (strcasecmp(d, "no-store") == 0 || strcasecmp(d, "private") == 0) {
+      info->no_store = 1;
+    } else if (strncasecmp(d, "s-maxage=", 9) == 0) {
+      info->max_age = atoi(d + 9);  // 공유 캐시에서는 s-maxage가 max-age보다 우선
+      info->s_maxage = 1;
+    } else if (strncasecmp(d, "max-age=", 8) == 0 && !info->s_maxage) {
+      info->max_age = atoi(d + 8);
+    } else if (strncasecmp(d, "stale-while-revalidate=", 23) == 0) {
+      info->swr = atoi(d + 23);
+    } else if (strncasecmp(d, "stale-if-error=", 15) == 0) {
+      info->sie = atoi(d + 15);
+    }
+  }
+}
 
-  return item;  // connfd 반환
+// 응답 바디 길이 (-1이면 chunked 또는 연결 종료까지라서 미리 알 수 없음)
+static long resp_body_length(const resp_info_t *info) {
+  if (resp_state.head || info->status / 100 == 1 || info->status == 204 || info->status == 304) {
+    return 0;  // 바디가 없는 응답
+  }
+  if (info->chunked) return -1;  // Transfer-Encoding이 Content-Length보다 우선
+  return info->content_length;
 }
 
-void *thread(void *vargp) {
-  pthread_detach(pthread_self()); // 스레드 자원 자동 회수
+// 상태 줄과 헤더를 읽어 캐시용 헤더 블록(hop-by-hop 헤더 제외)을 만듦. connfd >= 0이면 읽은 줄을 그대로 전달
+// (연결 관련 헤더는 빼고, 빈 줄 앞에 클라이언트 연결에 맞는 Connection 헤더를 넣음)
+// 빈 줄까지 정상적으로 읽었고 헤더가 MAXBUF 이내라면 1, 원 서버 연결이 끊겼거나 헤더가 너무 크면 0 반환
+// 100 Continue 같은 중간 응답은 전달하지 않고 건너뜀
+// stale이 있고 상태 코드가 5xx라면 아무것도 전달하지 않고 -1 반환 (stale-if-error)
+// 클라이언트에게 전달하다 실패하면 -2 반환
+// 상태 줄 없이 끊겼거나 HTTP/1.x 응답이 아니거나 505라면 아무것도 전달하지 않고 -3 반환 (다시 보낼 수 있음)
+// 원 서버의 응답 헤더 규칙(rules)은 전달하는 헤더와 캐시에 저장하는 헤더에 똑같이 적용
+// 압축해서 보낼 수 있는 요청(resp_state.gzip_ok)이면 헤더를 모아 두었다가 끝에서 압축 여부를 정해 한 번에 전달
+static int read_response_header(rio_t *rp, int connfd, char *hdr_buf, int *hdr_size,
+                                resp_info_t *info, cache_node_t *stale, const hdr_table_t *rules) {
+  static __thread char pend[MAXBUF], gz_hdr[MAXBUF + 128];  // 전달을 미룬 헤더 줄, gzip용으로 바꾼 헤더
+  char buf[MAXLINE];
+  int n, complete = 0, interim = 0, pend_len = 0;
+  int defer = connfd >= 0 && resp_state.gzip_ok;
+  uint64_t seen = 0;
 
-  while (1) {
-    int connfd = sbuf_remove(&sbuf);  // 작업 큐에서 connfd 꺼내기
-    func(connfd);                     // 요청 처리 함수 호출
-    close(connfd);                    // 클라이언트와의 연결 종료
+  *hdr_size = 0;
+  if (connfd >= 0) resp_state.gzip = 0;
+  memset(info, 0, sizeof(*info));
+  info->content_length = -1;
+  info->max_age = info->swr = info->sie = -1;
+  while ((n = rio_readlineb(rp, buf, MAXLINE)) > 0) {
+    if (interim) {
+      interim = strcmp(buf, "\r\n") != 0;  // 중간 응답이 끝나면 다음 줄이 다시 상태 줄
+      continue;
+    }
+    if (*hdr_size == 0) {
+      sscanf(buf, "%*s %d", &info->status);  // 상태 줄에서 상태 코드 추출
+      if (strncmp(buf, "HTTP/1.", 7) != 0 || info->status < 100 || info->status == 505) return -3;
+      info->keep_alive = buf[7] != '0';
+      if (info->status / 100 == 1 && info->status != 101) {
+        interim = 1;
+        continue;
+      }
+      if (stale && info->status >= 500) return -1;
+      if (strncmp(buf, "HTTP/1.0 ", 9) == 0) buf[7] = '1';  // 프록시 자신의 버전으로 응답 (chunked는 HTTP/1.1에만 쓸 수 있음)
+    }
+    if (strcmp(buf, "\r\n") == 0) { // 헤더 끝 감지
+      complete = 1;
+      // 규칙이 붙이는 줄 (헤더 블록에 자리가 없으면 캐시는 포기하고 전달만 함)
+      int fits = *hdr_size + hdr_rule_extra(rules) <= MAXBUF;
+      char *added = fits ? hdr_buf + *hdr_size : buf;
+      size_t alen = hdr_rule_append(rules, seen, added);
+      *hdr_size = fits ? *hdr_size + (int)alen : MAXBUF + 1;
+      if (connfd >= 0) {
+        // 텍스트 형식이고 인코딩되지 않은 전체 응답이면 압축 (규칙이 붙인 줄은 바꾸지 않음)
+        resp_state.gzip = defer && info->status == 200 && info->compressible && !info->encoded &&
+                          resp_body_length(info) != 0 &&
+                          (info->content_length < 0 || info->content_length >= config.gzip_min);
+        if (defer) {
+          const char *h = pend;
+          if (resp_state.gzip) {
+            pend_len = gzip_header(pend, pend_len, gz_hdr, -1);
+            h = gz_hdr;
+          }
+          if (rio_writen(connfd, (void *)h, pend_len) < 0) return -2;
+        }
+        // 길이를 모르는 응답(chunked 또는 연결 종료로 끝남, 압축하는 응답)은 HTTP/1.1 클라이언트에게 chunked로 전달하고,
+        // 그 외 클라이언트에게는 연결을 닫아서 끝을 알림
+        if (resp_body_length(info) < 0 || resp_state.gzip) {
+          if (resp_state.chunked_ok) {
+            resp_state.chunked = 1;
+          } else {
+            resp_state.close = 1;
+          }
+        }
+        const char *conn = conn_header();
+        if ((alen > 0 && rio_writen(connfd, added, alen) < 0) ||
+            (resp_state.chunked && rio_writen(connfd, "Transfer-Encoding: chunked\r\n", 28) < 0) ||
+            rio_writen(connfd, (void *)conn, strlen(conn)) < 0 || rio_writen(connfd, "\r\n", 2) < 0) return -2;
+      }
+      break;
+    }
+    size_t name_len = http_name_len(buf, n);
+    int id = name_len < (size_t)n ? http_header_id(buf, name_len) : HTTP_H_OTHER;  // 이름을 한 번만 분류
+    int keep = is_hop_header(id) ? 0 : hdr_rule_keep(rules, id, buf, name_len, &seen);
+    if (connfd >= 0 && keep && defer && pend_len + n > MAXBUF) {  // 모아 둘 자리가 없으면 압축하지 않고 그대로 전달
+      if (rio_writen(connfd, pend, pend_len) < 0) return -2;
+      defer = 0;
+    }
+    if (connfd >= 0 && keep && defer) {
+      memcpy(pend + pend_len, buf, n);
+      pend_len += n;
+    } else if (connfd >= 0 && keep && rio_writen(connfd, buf, n) < 0) {
+      return -2;
+    }
+    const char *value = buf + name_len + 1;
+    if (id == HTTP_H_AGE) {
+      info->age = atoi(value);  // Age는 적중 시 다시 계산하므로 값만 기억
+      continue;
+    }
+    if (id == HTTP_H_CONTENT_LENGTH) {
+      info->content_length = atol(value);
+    } else if (id == HTTP_H_CONNECTION) {
+      size_t len = strcspn(value, "\r\n");
+      if (has_token(value, len, "close")) {
+        info->keep_alive = 0;
+      } else if (has_token(value, len, "keep-alive")) {
+        info->keep_alive = 1;
+      }
+    } else if (id == HTTP_H_TRANSFER_ENCODING) {
+      info->chunked = has_token(value, strcspn(value, "\r\n"), "chunked");
+    } else if (id == HTTP_H_CACHE_CONTROL) {
+      parse_cache_control(value, info);
+    } else if (id == HTTP_H_CONTENT_TYPE) {
+      info->compressible = is_compressible_type(value);
+    } else if (id == HTTP_H_CONTENT_ENCODING) {
+      size_t len = strcspn(value, "\r\n");
+      info->gzipped = memchr(value, ',', len) == NULL && (has_token(value, len, "gzip") || has_token(value, len, "x-gzip"));
+      info->encoded = info->gzipped || !has_token(value, len, "identity");
+    }
+    if (!keep) continue;
+    if (*hdr_size + n > MAXBUF) {
+      *hdr_size = MAXBUF + 1;  // 헤더가 너무 크면 캐시하지 않음
+      continue;
+    }
+    memcpy(hdr_buf + *hdr_size, buf, n);
+    *hdr_size += n;
   }
+  if (info->status == 0) return -3;  // 상태 줄도 받지 못함 (재사용한 연결이 이미 닫혀 있었을 수 있음)
+  if (!complete && defer && pend_len > 0 && rio_writen(connfd, pend, pend_len) < 0) return -2;
+  if (!complete && connfd >= 0) resp_state.close = 1;  // 헤더 도중에 원 서버가 끊김
+  return complete && *hdr_size <= MAXBUF;
 }
 
-void cache_init(cache_t *cache) {
-  cache->head = NULL;
-  cache->tail = NULL;
-  cache->total_size = 0;
-  pthread_rwlock_init(&cache->lock, NULL);
+// 공유 캐시에 저장할 수 있는 응답인지 확인
+static int is_cacheable(const resp_info_t *info) {
+  if (info->status == 206) return 0;  // 부분 응답은 전체 객체 키로 저장하지 않음
+  if (info->no_store) return 0;
+  if (info->encoded && !info->gzipped) return 0;  // 인코딩별 키는 gzip만 있음
+  if (info->status >= 400 && config.neg_ttl_status <= 0) return 0;
+  return 1;
 }
 
-int find_cache_and_send(int connfd, cache_t *cache, const char *uri) {
-  pthread_rwlock_rdlock(&cache->lock);
-  cache_node_t *node = cache->head;
-  while (node) {
-      if (strcmp(node->uri, uri) == 0) {
-          Rio_writen(connfd, node->data, node->size);
-          pthread_rwlock_unlock(&cache->lock);
-          return 1;  // hit
+// 압축한 조각을 클라이언트에 보내고 (chunked면 chunk로 감쌈) 캐시용으로 gz_buf에 모음 (넘치면 *gz_size = -1)
+//    flush가 Z_FINISH면 gzip 트레일러까지 씀
+static int gzip_send(int connfd, z_stream *zs, const char *in, size_t len, int flush, char *gz_buf, int *gz_size) {
+  char zbuf[RELAY_BUFSIZE];
+
+  zs->next_in = (Bytef *)in;
+  zs->avail_in = len;
+  do {
+    zs->next_out = (Bytef *)zbuf;
+    zs->avail_out = sizeof(zbuf);
+    deflate(zs, flush);
+    size_t n = sizeof(zbuf) - zs->avail_out;
+    if (n == 0) continue;
+    if (resp_state.chunked ? write_chunk(connfd, zbuf, n) < 0 : rio_writen(connfd, zbuf, n) < 0) return -1;
+    if (*gz_size >= 0 && *gz_size + n <= MAX_OBJECT_SIZE) {
+      memcpy(gz_buf + *gz_size, zbuf, n);
+      *gz_size += n;
+    } else {
+      *gz_size = -1;
+    }
+  } while (zs->avail_out == 0);
+  return 0;
+}
+
+int relay_response(int connfd, upstream_t *up, const char *uri_key, int cache_ok, cache_node_t *stale) {
+  int serverfd = up->fd;
+  rio_t server_rio;
+  resp_info_t info;
+  body_reader_t body;
+  char buf[RELAY_BUFSIZE], dbuf[RELAY_BUFSIZE];
+  int n, hdr_size, data_size = 0;
+  size_t dlen;
+  char *hdr_buf = Malloc(MAXBUF);
+  char *object_buf = Malloc(MAX_OBJECT_SIZE);
+  timeout_t phase_to;
+
+  // 응답 헤더 전송 (캐시에는 헤더와 바디를 따로 저장)
+  //    헤더는 줄마다 쓰므로 cork로 묶었다가 첫 바디 조각과 함께 내보냄
+  int corked = config.listen.cork && resp_state.sock;
+  if (corked) set_cork(connfd, 1);
+  rio_readinitb(&server_rio, serverfd);
+  timeout_start(&phase_to, TO_FIRST_BYTE, config.timeout_first_byte * 1000, serverfd, -1);
+  int cacheable = read_response_header(&server_rio, connfd, hdr_buf, &hdr_size, &info, stale,
+                                       hdr_rules_lookup(HDR_RESPONSE, up->host, strlen(up->host)));
+  if (timeout_cancel(&phase_to)) {
+    if (corked) set_cork(connfd, 0);
+    if (info.status == 0) {  // 아직 아무것도 전달하지 않았다면 504 (또는 stale-if-error)
+      if (stale) {
+        send_cached(connfd, stale, NULL);
+      } else {
+        send_error(connfd, "504", "Gateway Timeout", "Origin didn't respond in time");
       }
-      node = node->next;
+    } else {
+      resp_state.close = 1;  // 헤더 일부만 전달됨
+    }
+    free(hdr_buf);
+    free(object_buf);
+    return UP_CLOSE;
   }
-  pthread_rwlock_unlock(&cache->lock);
-  return 0; // miss
+  if (cacheable < 0) {
+    if (corked) set_cork(connfd, 0);
+    if (cacheable == -1) {  // 원 서버 에러: 만료된 캐시로 응답
+      send_cached(connfd, stale, NULL);
+    } else if (cacheable == -2) {
+      resp_state.close = 1;  // 클라이언트 연결이 끊김
+    }
+    free(hdr_buf);
+    free(object_buf);
+    return cacheable == -3 ? UP_RETRY : UP_CLOSE;  // -3: 호출자가 다시 보내거나 502로 응답
+  }
+  cacheable = cacheable && is_cacheable(&info);
+
+  // 압축해서 보내는 응답: 원본은 object_buf에, 압축 결과는 gz_buf에 모아 두 변형을 함께 저장
+  z_stream zs = {0};
+  char *gz_buf = NULL;
+  int gz_size = 0, gz = resp_state.gzip;
+  if (gz && deflateInit2(&zs, config.gzip_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+    gz_buf = Malloc(MAX_OBJECT_SIZE);
+    __atomic_add_fetch(&gzip_streamed, 1, __ATOMIC_RELAXED);
+  } else if (gz) {
+    cacheable = 0;  // 이미 gzip 헤더를 보냈으므로 압축 없이는 보낼 수 없음
+    resp_state.close = 1;
+    free(hdr_buf);
+    free(object_buf);
+    return UP_CLOSE;
+  }
+
+  // 응답 바디 전송 (원 서버 에러 시 잘린 응답은 캐시하지 않음, 클라이언트 에러 시 중단)
+  //    chunked 응답은 HTTP/1.1 클라이언트에게는 받은 그대로, 아니면 풀어서 전달하고 캐시에는 푼 데이터를 저장
+  //    길이를 모르는 응답은 HTTP/1.1 클라이언트에게 chunked로 감싸서 보내 연결을 유지
+  //    압축하는 응답은 원 서버에서 더 읽을 바이트가 버퍼에 없을 때마다 Z_SYNC_FLUSH로 내보내 늦게 오는 바디를 붙잡아 두지 않음
+  //    데이터가 올 때마다 무응답 제한 시간을 다시 늘림
+  body_init(&body, &server_rio, info.chunked, resp_body_length(&info));
+  char *out = body.chunked && resp_state.chunked && !gz ? dbuf : buf;  // 그대로 전달할 때만 원본을 남겨 둠
+  timeout_start(&phase_to, TO_IDLE, config.timeout_idle * 1000, serverfd, -1);
+  while ((n = read_body(&body, buf, RELAY_BUFSIZE, out, &dlen)) > 0) {
+    timeout_extend(&phase_to, config.timeout_idle * 1000);
+    int rc;
+    if (gz) {
+      rc = gzip_send(connfd, &zs, out, dlen, server_rio.rio_cnt > 0 ? Z_NO_FLUSH : Z_SYNC_FLUSH, gz_buf, &gz_size);
+    } else if (resp_state.chunked && !body.chunked) {
+      rc = write_chunk(connfd, out, dlen);
+    } else if (resp_state.chunked) {
+      rc = rio_writen(connfd, buf, n) < 0 ? -1 : 0;
+    } else {
+      rc = rio_writen(connfd, out, dlen) < 0 ? -1 : 0;
+    }
+    if (rc < 0) {
+      cacheable = 0;
+      break;
+    }
+    if (corked) {
+      set_cork(connfd, 0);  // 헤더 + 첫 조각 전송, 이후 조각은 바로 보냄
+      corked = 0;
+    }
+    if (hdr_size + data_size + dlen > MAX_OBJECT_SIZE) {
+      cacheable = 0;  // 객체 크기 초과 시 잘린 응답이 저장되지 않도록 캐시 포기
+      continue;
+    }
+    memcpy(object_buf + data_size, out, dlen);
+    data_size += dlen;
+  }
+  if (n < 0) cacheable = 0;
+  if (timeout_cancel(&phase_to)) {  // 무응답으로 끊긴 응답은 EOF처럼 보이므로 저장하지 않음
+    cacheable = 0;
+    n = -1;
+  }
+  // 원 서버가 연결을 유지하고 바디를 프레이밍대로 끝까지 읽었다면 (뒤에 남은 바이트 없이) 다음 요청에 재사용
+  int result = info.keep_alive && n == 0 && (body.chunked || body.remaining == 0) && server_rio.rio_cnt <= 0
+               ? UP_REUSE : UP_CLOSE;
+  if (gz) {
+    if (n == 0 && gzip_send(connfd, &zs, NULL, 0, Z_FINISH, gz_buf, &gz_size) < 0) n = -1;
+    __atomic_add_fetch(&gzip_in, zs.total_in, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gzip_out, zs.total_out, __ATOMIC_RELAXED);
+    deflateEnd(&zs);
+  }
+  if (n == 0 && resp_state.chunked && (!body.chunked || gz) && write_chunk(connfd, NULL, 0) < 0) n = -1;  // 마지막 chunk
+  if (corked) set_cork(connfd, 0);  // 바디가 없는 응답
+  if (n != 0) {
+    resp_state.close = 1;  // 잘린 응답: 클라이언트는 연결이 닫혀야 끝을 알 수 있음
+  }
+
+  // 캐시 저장 (크기 조건 만족 시, 4xx/5xx 응답은 짧은 TTL로 저장)
+  //    원 서버가 gzip으로 보낸 응답은 gzip 변형 키로, 압축해서 보낸 응답은 원본과 gzip 변형을 함께 저장
+  if (cache_ok && cacheable) {
+    char gz_uri[MAXLINE];
+    if (!info.gzipped) {
+      release_cache(insert_cache(&cache, uri_key, &info, hdr_buf, hdr_size, object_buf, data_size));
+    } else if (gzip_key(uri_key, gz_uri) == 0) {
+      release_cache(insert_cache(&cache, gz_uri, &info, hdr_buf, hdr_size, object_buf, data_size));
+    }
+    if (gz && gz_size >= 0 && hdr_size + 128 <= MAXBUF && gzip_key(uri_key, gz_uri) == 0) {
+      char *gz_hdr = Malloc(hdr_size + 128);
+      int gz_hdr_size = gzip_header(hdr_buf, hdr_size, gz_hdr, gz_size);
+      resp_info_t gz_info = info;
+      gz_info.content_length = gz_size;
+      gz_info.encoded = gz_info.gzipped = 1;
+      release_cache(insert_cache(&cache, gz_uri, &gz_info, gz_hdr, gz_hdr_size, gz_buf, gz_size));
+      free(gz_hdr);
+    }
+  }
+
+  free(gz_buf);
+  free(hdr_buf);
+  free(object_buf);
+  return result;
 }
 
-void insert_cache(cache_t *cache, const char *uri, const char *data, int size) {
-  pthread_rwlock_wrlock(&cache->lock); // 캐시 접근 보호(동기화)
+cache_node_t *fetch_into_cache(upstream_t *up, const char *uri_key, cache_node_t *stale, int *result) {
+  int serverfd = up->fd;
+  rio_t server_rio;
+  resp_info_t info;
+  body_reader_t body;
+  int n = 0, hdr_size, data_size = 0;
+  size_t dlen;
+  cache_node_t *node = NULL;
+  char *hdr_buf = Malloc(MAXBUF);
+  char *object_buf = Malloc(MAX_OBJECT_SIZE + 1);
+  timeout_t phase_to;
 
-  // 필요한 공간 확보. 초과한 경우 맨 뒤 노드를 제거
-  while (cache->total_size + size > MAX_CACHE_SIZE) {
-    evict_cache(cache);
+  rio_readinitb(&server_rio, serverfd);
+  timeout_start(&phase_to, TO_FIRST_BYTE, config.timeout_first_byte * 1000, serverfd, -1);
+  int cacheable = read_response_header(&server_rio, -1, hdr_buf, &hdr_size, &info, stale,
+                                       hdr_rules_lookup(HDR_RESPONSE, up->host, strlen(up->host)));
+  if (timeout_cancel(&phase_to)) cacheable = 0;
+  *result = cacheable == -3 ? UP_RETRY : UP_CLOSE;
+  if (cacheable == -1) {  // 원 서버 에러: 만료된 캐시를 대신 돌려줌
+    __atomic_add_fetch(&stale->refcnt, 1, __ATOMIC_RELAXED);
+    free(hdr_buf);
+    free(object_buf);
+    return stale;
   }
+  cacheable = cacheable && is_cacheable(&info) && !info.encoded;  // 원본 키로만 저장하므로 인코딩된 응답은 제외
+  if (info.content_length > MAX_OBJECT_SIZE - hdr_size) cacheable = 0;  // 크기를 미리 알 수 있다면 바디를 읽지 않음
 
-  // 새로운 노드 생성
-  cache_node_t *node = Malloc(sizeof(cache_node_t));
-  node->uri = Malloc(strlen(uri) + 1);  // 널 문자가 없을 수도 있으므로 +1 할당
-  strcpy(node->uri, uri);
+  if (cacheable) {
+    // 제한 크기 + 1 바이트까지 읽어서 초과 여부 판단 (chunked는 읽은 자리에서 바로 풂)
+    int limit = MAX_OBJECT_SIZE - hdr_size + 1;
+    body_init(&body, &server_rio, info.chunked, resp_body_length(&info));
+    timeout_start(&phase_to, TO_IDLE, config.timeout_idle * 1000, serverfd, -1);
+    while (data_size < limit && (n = read_body(&body, object_buf + data_size, limit - data_size,
+                                               object_buf + data_size, &dlen)) > 0) {
+      data_size += dlen;
+      timeout_extend(&phase_to, config.timeout_idle * 1000);
+    }
+    if (timeout_cancel(&phase_to)) n = -1;
+    if (n >= 0 && data_size < limit) {  // 원 서버 에러로 잘린 응답은 저장하지 않음
+      node = insert_cache(&cache, uri_key, &info, hdr_buf, hdr_size, object_buf, data_size);
+    }
+    if (n == 0 && info.keep_alive && (body.chunked || body.remaining == 0) && server_rio.rio_cnt <= 0) {
+      *result = UP_REUSE;  // 바디를 끝까지 읽음: 연결 재사용
+    }
+  }
 
-  node->data = Malloc(size);
-  memcpy(node->data, data, size);
-  node->size = size;
+  free(hdr_buf);
+  free(object_buf);
+  return node;
+}
 
-  // 리스트 앞에 삽입
-  node->prev = NULL;
-  node->next = cache->head;
-  if (cache->head) {
-    cache->head->prev = node;
+void body_init(body_reader_t *b, rio_t *rp, int chunked, long length) {
+  b->rp = rp;
+  b->chunked = chunked && length != 0;  // 바디가 없는 응답이라면 chunked 헤더는 무시
+  http_chunked_init(&b->dec);
+  b->remaining = b->chunked ? -1 : length;
+}
+
+ssize_t read_body(body_reader_t *b, char *raw, size_t cap, char *out, size_t *outlen) {
+  *outlen = 0;
+  if (b->chunked && http_chunked_done(&b->dec)) return 0;  // 마지막 chunk까지 읽음 (그 뒤 바이트는 무시)
+  if (b->remaining == 0) return 0;  // Content-Length만큼 다 읽음: 원 서버가 닫기를 기다리지 않음
+  if (b->chunked) {
+    // 읽기 버퍼 안에서 바로 풀고 디코더가 소비한 만큼만 꺼냄 (마지막 chunk 뒤의 다음 요청/응답은 남겨 둠)
+    char *p;
+    ssize_t n = rio_peekb(b->rp, &p, 1);
+    if (n <= 0) return -1;  // 마지막 chunk 전에 끊김
+    size_t avail = b->rp->rio_cnt < 0 || (size_t)b->rp->rio_cnt > cap ? cap : (size_t)b->rp->rio_cnt;
+    long used = http_chunked_decode(&b->dec, p, avail, out, outlen);
+    if (used <= 0) return -1;
+    if (out != raw) memcpy(raw, p, used);
+    rio_consumeb(b->rp, used);
+    return used;
+  }
+  if (b->remaining > 0 && (size_t)b->remaining < cap) {
+    cap = b->remaining;  // 남은 길이만큼만 요청 (다음 요청/응답의 바이트를 읽지 않도록)
   }
-  cache->head = node;
 
-  if (cache->tail == NULL) {  
-    cache->tail = node; // 첫 노드라면 tail로도 설정
+  ssize_t n = rio_readsomeb(b->rp, raw, cap);
+  if (n <= 0) {
+    return n < 0 || b->remaining >= 0 ? -1 : 0;  // 길이를 아는 바디가 덜 왔다면 잘린 바디
   }
+  if (b->remaining > 0) b->remaining -= n;
+  if (out && out != raw) memcpy(out, raw, n);
+  *outlen = n;
+  return n;
+}
 
-  cache->total_size += size;  // 데이터 양만큼 전체 데이터 크기 증가
-  pthread_rwlock_unlock(&cache->lock); // 캐시 접근 보호 해제(동기화 해제)
+int write_chunk(int fd, const char *data, size_t n) {
+  char size[32];
+  struct iovec iov[3];
+
+  if (n == 0) {
+    return rio_writen(fd, "0\r\n\r\n", 5) < 0 ? -1 : 0;
+  }
+  iov[0].iov_base = size;
+  iov[0].iov_len = snprintf(size, sizeof(size), "%zx\r\n", n);
+  iov[1].iov_base = (void *)data;
+  iov[1].iov_len = n;
+  iov[2].iov_base = "\r\n";
+  iov[2].iov_len = 2;
+  return rio_writev(fd, iov, 3) < 0 ? -1 : 0;
 }
 
-void evict_cache(cache_t *cache) {
-  if (cache->tail == NULL) return;
+// "Range: bytes=first-last" 해석. 1: 유효한 범위, 0: 만족할 수 없는 범위, -1: 지원하지 않는 형식 (무시)
+int parse_range(const char *line, long size, long *first, long *last) {
+  const char *spec = line + 6;  // "Range:" 이후
+  char *end;
 
-  cache_node_t *node = cache->tail;
+  while (*spec == ' ' || *spec == '\t') spec++;
+  if (strncasecmp(spec, "bytes=", 6) != 0) return -1;
+  spec += 6;
+  if (strchr(spec, ',')) return -1;  // 다중 범위는 지원하지 않음
 
-  // 리스트에서 제거
-  if (node->prev) {
-    node->prev->next = NULL;
+  if (*spec == '-') {  // "bytes=-N": 마지막 N 바이트
+    long suffix = strtol(spec + 1, &end, 10);
+    if (end == spec + 1 || suffix < 0) return -1;
+    if (suffix == 0 || size == 0) return 0;
+    *first = suffix >= size ? 0 : size - suffix;
+    *last = size - 1;
+    return 1;
+  }
+
+  *first = strtol(spec, &end, 10);
+  if (end == spec || *end != '-' || *first < 0) return -1;
+  spec = end + 1;
+  if (isdigit((unsigned char)*spec)) {
+    *last = strtol(spec, &end, 10);
+    if (*last < *first) return -1;
   } else {
-    cache->head = NULL;
+    *last = size - 1;  // "bytes=N-": 끝까지
   }
+  if (*first >= size) return 0;
+  if (*last >= size) *last = size - 1;
+  return 1;
+}
 
-  cache->tail = node->prev;
+void send_error(int connfd, char *errnum, char *shortmsg, char *longmsg) {
+  char buf[MAXLINE], body[MAXBUF];
 
-  // 메모리 해제 및 데이터 양만큼 전체 데이터 크기 감소
-  cache->total_size -= node->size;
-  free(node->uri);
-  free(node->data);
-  free(node);
-}
\ No newline at end of file
+  // build HTTP 응답 body
+  snprintf(body, sizeof(body), "<html><title>Proxy Error</title><body bgcolor=\"ffffff\">\r\n"
+           "%s: %s\r\n<p>%s\r\n<hr><em>The Proxy Server</em>\r\n", errnum, shortmsg, longmsg);
+
+  // HTTP 응답 출력
+  snprintf(buf, sizeof(buf), "HTTP/1.0 %s %s\r\nContent-type: text/html\r\nContent-length: %d\r\n%s\r\n",
+           errnum, shortmsg, (int)strlen(body), conn_header());
+  if (rio_writen(connfd, buf, strlen(buf)) < 0) return;  // 클라이언트가 이미 끊은 경우
+  rio_writen(connfd, body, strlen(body));
+}
+
+// ':' 앞까지를 이름으로 보고 분류 (':'가 없는 줄은 HTTP_H_OTHER)
+int line_header_id(const char *line, size_t len) {
+  size_t name_len = http_name_len(line, len);
+  return name_len < len ? http_header_id(line, name_len) : HTTP_H_OTHER;
+}
+
+int is_hop_header(int id) {
+  return id == HTTP_H_CONNECTION ||
+         id == HTTP_H_PROXY_CONNECTION ||
+         id == HTTP_H_KEEP_ALIVE ||
+         id == HTTP_H_TRANSFER_ENCODING ||  // 캐시에는 푼 바디를 저장하고, 전달할 때는 프록시가 다시 정함
+         id == HTTP_H_X_CACHE;
+}
+
+void send_stats(int connfd) {
+  char buf[MAXLINE], body[MAXBUF];
+  dns_stats_t dns;
+  unsigned long timeouts[TO_KINDS];
+  int n;
+
+  dns_cache_stats(&dns);
+  n = snprintf(body, sizeof(body),
+               "dns_hits %lu\ndns_misses %lu\ndns_neg_hits %lu\ndns_collapsed %lu\n"
+               "dns_refreshes %lu\ndns_entries %lu\n",
+               dns.hits, dns.misses, dns.neg_hits, dns.collapsed, dns.refreshes, dns.entries);
+  n += snprintf(body + n, sizeof(body) - n, "accept_batches %lu\naccept_conns %lu\naccept_batch_max %lu\n",
+                __atomic_load_n(&accept_batches, __ATOMIC_RELAXED),
+                __atomic_load_n(&accept_conns, __ATOMIC_RELAXED),
+                __atomic_load_n(&accept_batch_max, __ATOMIC_RELAXED));
+  n += snprintf(body + n, sizeof(body) - n, "zerocopy_sends %lu\nzerocopy_copied %lu\nzerocopy_aborted %lu\n",
+                __atomic_load_n(&zc_sends, __ATOMIC_RELAXED),
+                __atomic_load_n(&zc_copied, __ATOMIC_RELAXED),
+                __atomic_load_n(&zc_aborted, __ATOMIC_RELAXED));
+  n += snprintf(body + n, sizeof(body) - n, "keepalive_reuses %lu\npipeline_requests %lu\npipeline_hits %lu\n"
+                "pipeline_inline %lu\npipeline_depth_max %lu\n",
+                __atomic_load_n(&keepalive_reuses, __ATOMIC_RELAXED),
+                __atomic_load_n(&pipeline_requests, __ATOMIC_RELAXED),
+                __atomic_load_n(&pipeline_hits, __ATOMIC_RELAXED),
+                __atomic_load_n(&pipeline_inline, __ATOMIC_RELAXED),
+                __atomic_load_n(&pipeline_depth_max, __ATOMIC_RELAXED));
+  n += snprintf(body + n, sizeof(body) - n, "tunnel_opened %lu\ntunnel_bytes %lu\n",
+                __atomic_load_n(&tunnel_opened, __ATOMIC_RELAXED),
+                __atomic_load_n(&tunnel_bytes, __ATOMIC_RELAXED));
+  pthread_mutex_lock(&upstream_pool.mutex);
+  int idle = upstream_pool.n;
+  pthread_mutex_unlock(&upstream_pool.mutex);
+  n += snprintf(body + n, sizeof(body) - n, "upstream_reuses %lu\nupstream_fallbacks %lu\nupstream_idle %d\n",
+                __atomic_load_n(&upstream_reuses, __ATOMIC_RELAXED),
+                __atomic_load_n(&upstream_fallbacks, __ATOMIC_RELAXED), idle);
+  n += snprintf(body + n, sizeof(body) - n, "h2_conns %lu\nh2_streams %lu\n",
+                __atomic_load_n(&h2_conns, __ATOMIC_RELAXED),
+                __atomic_load_n(&h2_streams, __ATOMIC_RELAXED));
+  n += snprintf(body + n, sizeof(body) - n, "gzip_streamed %lu\ngzip_variants %lu\ngzip_in %lu\ngzip_out %lu\n",
+                __atomic_load_n(&gzip_streamed, __ATOMIC_RELAXED),
+                __atomic_load_n(&gzip_variants, __ATOMIC_RELAXED),
+                __atomic_load_n(&gzip_in, __ATOMIC_RELAXED),
+                __atomic_load_n(&gzip_out, __ATOMIC_RELAXED));
+  timeout_stats(timeouts);
+  for (int i = 0; i < TO_KINDS; i++) {
+    n += snprintf(body + n, sizeof(body) - n, "timeout_%s %lu\n", timeout_name(i), timeouts[i]);
+  }
+
+  snprintf(buf, sizeof(buf), "HTTP/1.0 200 OK\r\nContent-type: text/plain\r\nContent-length: %d\r\n%s\r\n",
+           (int)strlen(body), conn_header());
+  if (rio_writen(connfd, buf, strlen(buf)) < 0) return;
+  rio_writen(connfd, body, strlen(body));
+}
+
+// 읽지 않은 데이터가 남은 채로 close하면 커널이 RST를 보내 클라이언트가 응답을 못 받을 수 있음
+void drain_client(int connfd) {
+  char buf[MAXBUF];
+  struct pollfd pfd = {.fd = connfd, .events = POLLIN};
+  size_t total = 0;
+  ssize_t n;
+
+  shutdown(connfd, SHUT_WR);  // 응답 끝을 알림
+  while (total < MAX_OBJECT_SIZE && poll(&pfd, 1, 1000) > 0 && (n = read(connfd, buf, sizeof(buf))) > 0) {
+    total += n;
+  }
+}
+
+int read_request_head(rio_t *rp, http_req_t *req, int wait) {
+  char *buf;
+  size_t avail;
+  ssize_t n;
+  int rc;
+
+  http_req_init(req);
+  buf = rp->rio_bufptr;
+  avail = rp->rio_cnt > 0 ? rp->rio_cnt : 0;  // 이전 요청 뒤에 이미 읽어 둔 바이트부터 파싱
+  while ((rc = http_parse_request(req, buf, avail)) == HTTP_PARSE_AGAIN) {
+    if (!wait) {  // 소켓에 이미 도착한 바이트가 있을 때만 읽음
+      struct pollfd pfd = {.fd = rp->rio_fd, .events = POLLIN};
+      if (poll(&pfd, 1, 0) <= 0) return REQ_PENDING;
+    }
+    if ((n = rio_peekmore(rp, &buf, &avail)) > 0) continue;
+    if (n == 0 && avail == RIO_BUFSIZE) {  // 버퍼가 가득 찼는데 헤더가 끝나지 않음
+      req->status = 431;
+      return HTTP_PARSE_ERROR;
+    }
+    return 0;  // EOF 또는 에러
+  }
+  return rc;
+}
+
+// 절대 URI에서 parse_uri가 원 서버 호스트로 볼 부분 (절대 URI가 아니면 NULL)
+static const char *uri_host(const char *uri, size_t *len) {
+  if (strncasecmp(uri, "http://", 7) != 0) return NULL;
+  *len = strcspn(uri + 7, "/:");
+  return uri + 7;
+}
+
+int read_client_request(rio_t *rp, client_req_t *creq, int wait) {
+  http_req_t req;
+  int has_length = 0, bad_framing = 0;
+
+  int head_len = read_request_head(rp, &req, wait);
+  if (head_len == 0 || head_len == REQ_PENDING) return head_len;
+  creq->method[0] = creq->uri[0] = creq->range[0] = '\0';
+  creq->hdrs = NULL;
+  creq->body_len = 0;
+  creq->expect_continue = 0;
+  creq->tunnel = 0;
+  creq->keep_alive = 0;
+  creq->chunked_ok = 0;
+  creq->gzip_ok = 0;
+  creq->status = 0;
+  if (head_len == HTTP_PARSE_ERROR) {  // 형식 오류 또는 너무 큰 헤더 (요청 경계를 알 수 없으므로 소비하지 않음)
+      creq->status = req.status;
+      return 1;
+  }
+  char *base = rp->rio_bufptr;  // 기록된 오프셋의 기준 (헤더를 다 쓴 뒤에 소비)
+  if (req.uri.len >= sizeof(creq->uri)) {
+      creq->status = 414;
+      return 1;
+  }
+  if (req.method.len >= sizeof(creq->method)) {
+      creq->status = 501;
+      return 1;
+  }
+  memcpy(creq->method, HTTP_PTR(base, req.method), req.method.len);
+  creq->method[req.method.len] = '\0';
+  memcpy(creq->uri, HTTP_PTR(base, req.uri), req.uri.len);
+  creq->uri[req.uri.len] = '\0';
+  creq->tunnel = strcmp(creq->method, "CONNECT") == 0;
+
+  // 요청 헤더 정리 (Range는 따로 보관, 연결 관련 헤더는 버리고 나머지는 "이름: 값" 형태로 저장)
+  //    바디 길이는 Content-Length 또는 chunked로 정함. 둘 다 있거나 값이 어긋나면 경계를 믿을 수 없으므로 400
+  //    원 서버의 요청 헤더 규칙으로 줄마다 남길지 정하고, 규칙이 붙이는 줄은 끝에 한 번에 씀
+  //    다시 쓴 줄은 원래 줄보다 최대 2바이트(": "의 공백, "\r") 길어짐
+  //    HTTP/1.1은 기본이 keep-alive, HTTP/1.0은 "Connection: keep-alive"가 있어야 유지
+  int keep_alive = req.minor >= 1;
+  size_t hdrs_len = 0, host_len = 0;
+  const char *host = uri_host(creq->uri, &host_len);
+  const hdr_table_t *rules = host ? hdr_rules_lookup(HDR_REQUEST, host, host_len) : NULL;
+  uint64_t seen = 0;
+  char *hdrs = Malloc(head_len + 2 * req.nhdrs + hdr_rule_extra(rules) + 1);
+  for (int i = 0; i < req.nhdrs; i++) {
+      http_hdr_t *h = &req.hdrs[i];
+      const char *value = HTTP_PTR(base, h->value);
+      switch (h->id) {
+      case HTTP_H_CONNECTION:
+      case HTTP_H_PROXY_CONNECTION:
+          if (has_token(value, h->value.len, "close")) {
+              keep_alive = 0;
+          } else if (has_token(value, h->value.len, "keep-alive")) {
+              keep_alive = 1;
+          }
+          continue;
+      case HTTP_H_HOST:
+      case HTTP_H_KEEP_ALIVE:
+          continue;  // 프록시가 직접 채움
+      case HTTP_H_TE:
+      case HTTP_H_UPGRADE:
+      case HTTP_H_PROXY_AUTHORIZATION:
+          continue;  // 클라이언트와 프록시 사이의 연결에만 해당 (원 서버 연결은 프록시가 정함)
+      case HTTP_H_RANGE:
+          snprintf(creq->range, sizeof(creq->range), "Range: %.*s\r\n", (int)h->value.len, value);
+          continue;
+      case HTTP_H_EXPECT:
+          creq->expect_continue = has_token(value, h->value.len, "100-continue");
+          continue;  // 100 응답은 프록시가 직접 보냄
+      case HTTP_H_CONTENT_LENGTH: {
+          long len = 0;
+          size_t k = 0;
+          while (k < h->value.len && k < 18 && isdigit((unsigned char)value[k])) len = len * 10 + (value[k++] - '0');
+          if (k == 0 || k < h->value.len || (has_length && len != creq->body_len)) bad_framing = 1;
+          if (creq->body_len >= 0) creq->body_len = len;
+          has_length = 1;
+          break;
+      }
+      case HTTP_H_TRANSFER_ENCODING:
+          // chunked가 아닌 전송 코딩만 있다면 바디 끝을 알 수 없음
+          if (!has_token(value, h->value.len, "chunked")) bad_framing = 1;
+          creq->body_len = -1;
+          break;
+      case HTTP_H_ACCEPT_ENCODING:
+          creq->gzip_ok = config.gzip && accepts_gzip(value, h->value.len);
+          break;  // 원 서버가 직접 압축할 수 있도록 그대로 전달
+      }
+      if (!hdr_rule_keep(rules, h->id, HTTP_PTR(base, h->name), h->name.len, &seen)) continue;
+      memcpy(hdrs + hdrs_len, HTTP_PTR(base, h->name), h->name.len);
+      hdrs_len += h->name.len;
+      memcpy(hdrs + hdrs_len, ": ", 2);
+      hdrs_len += 2;
+      memcpy(hdrs + hdrs_len, value, h->value.len);
+      hdrs_len += h->value.len;
+      memcpy(hdrs + hdrs_len, "\r\n", 2);
+      hdrs_len += 2;
+  }
+  hdrs_len += hdr_rule_append(rules, seen, hdrs + hdrs_len);
+  hdrs[hdrs_len] = '\0';
+  if (bad_framing || (has_length && creq->body_len < 0)) {
+      free(hdrs);
+      creq->status = 400;
+      return 1;
+  }
+  creq->hdrs = hdrs;
+  creq->keep_alive = keep_alive && config.keepalive_timeout > 0;
+  creq->chunked_ok = req.minor >= 1;
+  rio_consumeb(rp, head_len);  // 헤더 블록을 버퍼에서 소비
+  return 1;
+}
+
+int has_token(const char *value, size_t len, const char *token) {
+  size_t tlen = strlen(token);
+  const char *end = value + len;
+
+  while (value < end) {
+    while (value < end && (*value == ' ' || *value == '\t' || *value == ',')) value++;
+    const char *start = value;
+    while (value < end && *value != ',') value++;
+    const char *last = value;
+    while (last > start && (last[-1] == ' ' || last[-1] == '\t')) last--;
+    if ((size_t)(last - start) == tlen && strncasecmp(start, token, tlen) == 0) return 1;
+  }
+  return 0;
+}
+
+int needs_client(const client_req_t *creq) {
+  return creq->status == 0 && (creq->body_len != 0 || creq->tunnel);
+}
+
+// keep-alive를 원하는 클라이언트라도 응답 길이를 알 수 없거나 응답이 잘리면 close
+const char *conn_header(void) {
+  return resp_state.keep_alive && !resp_state.close ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+}
+
+int parse_uri(char *uri, char*host, char *port, char *path) {
+  // "http://www.example.com:8000/index.html"
+  char *hostbegin, *hostend, *pathbegin, *portbegin;
+
+  if (strncasecmp(uri, "http://", 7) != 0) {  // 대소문자 구분 없이 접두어 확인
+    return -1;
+  }
+  // 파일 경로 찾기
+  hostbegin = uri + 7;  // http:// 이후부터 시작
+  pathbegin = strchr(hostbegin, '/'); 
+  if (pathbegin) {  // '/'가 있다면
+    strcpy(path, pathbegin);  // 경로에 이후 내용(파일 경로)을 저장
+    *pathbegin = '\0';        // '/' 이전 이후로 문자열 분리
+  } else {
+    strcpy(path, "/");        // '/'가 없다면 path에 '/'를 저장
+  }
+  // 포트 번호 찾기
+  portbegin = strchr(hostbegin, ':');
+  if (portbegin) {  // ':'가 있다면
+    *portbegin = '\0';  // ':'를 기준으로 host시작부를 분리
+    strcpy(host, hostbegin);
+    strcpy(port, portbegin + 1);
+  } else {
+    strcpy(host, hostbegin);  // ':'가 없다면 전부 호스트 문자열
+    strcpy(port, "80"); // 기본 포트 설정
+  }
+
+  return 0;
+}
+
+// CONNECT 대상 "host:port" 또는 "[IPv6]:port" 해석 (포트가 없으면 CONNECT_PORT)
+static int parse_authority(const char *uri, char *host, char *port) {
+  const char *colon;
+
+  if (uri[0] == '[') {
+    const char *end = strchr(uri, ']');
+    if (end == NULL || (end[1] != '\0' && end[1] != ':')) return -1;
+    snprintf(host, MAXLINE, "%.*s", (int)(end - uri - 1), uri + 1);
+    colon = end[1] == ':' ? end + 1 : NULL;
+  } else {
+    colon = strrchr(uri, ':');
+    snprintf(host, MAXLINE, "%.*s", colon ? (int)(colon - uri) : (int)strlen(uri), uri);
+  }
+  if (colon == NULL || colon[1] == '\0') {
+    strcpy(port, CONNECT_PORT);
+  } else if (strlen(colon + 1) < 6 && strspn(colon + 1, "0123456789") == strlen(colon + 1)) {
+    strcpy(port, colon + 1);
+  } else {
+    return -1;
+  }
+  return host[0] ? 0 : -1;
+}
+
+void open_tunnel(int connfd, client_req_t *creq, rio_t *client_rp) {
+  static const char *established = "HTTP/1.1 200 Connection Established\r\n\r\n";
+  char host[MAXLINE], port[10];
+
+  resp_state.close = 1;  // 터널이 끝나면 연결도 끝남 (에러 응답에도 Connection: close)
+  if (parse_authority(creq->uri, host, port) < 0) {
+    send_error(connfd, "400", "Bad Request", "Proxy couldn't parse the CONNECT target");
+    return;
+  }
+  int serverfd = connect_origin(connfd, host, port, NULL, NULL);
+  if (serverfd < 0) return;
+  if (rio_writen(connfd, (void *)established, strlen(established)) < 0) {
+    close(serverfd);
+    return;
+  }
+
+  // 요청 헤더와 함께 이미 읽어 둔 바이트 (TLS ClientHello 등)부터 원 서버로 보낸 뒤 중계
+  long moved = 0;
+  if (client_rp->rio_cnt > 0) {
+    if (rio_writen(serverfd, client_rp->rio_bufptr, client_rp->rio_cnt) < 0) {
+      close(serverfd);
+      return;
+    }
+    moved = client_rp->rio_cnt;
+    rio_consumeb(client_rp, client_rp->rio_cnt);
+  }
+  __atomic_add_fetch(&tunnel_opened, 1, __ATOMIC_RELAXED);
+  moved += tunnel_relay(connfd, serverfd);
+  __atomic_add_fetch(&tunnel_bytes, moved, __ATOMIC_RELAXED);
+  close(serverfd);
+}
+
+// 방향마다 (소켓 -> 파이프 -> 소켓) splice로 옮겨 바이트를 사용자 공간으로 복사하지 않음
+// 파이프가 비었을 때만 읽고, 파이프에 남은 바이트는 받는 쪽이 쓰기 가능해지면 내보냄
+// 한쪽이 EOF를 보내면 남은 바이트를 다 보낸 뒤 반대쪽에 shutdown(SHUT_WR)으로 전하고,
+// 양쪽이 모두 끝나거나 timeout_idle 동안 아무 데이터도 오가지 않으면 종료
+long tunnel_relay(int fd1, int fd2) {
+  int fds[2] = {fd1, fd2}, pipes[2][2], eof[2] = {0, 0}, shut[2] = {0, 0};
+  size_t pending[2] = {0, 0};  // 방향 i (fds[i] -> fds[1 - i])의 파이프에 남은 바이트
+  long total = 0;
+
+  if (pipe(pipes[0]) < 0) return 0;
+  if (pipe(pipes[1]) < 0) {
+    close(pipes[0][0]);
+    close(pipes[0][1]);
+    return 0;
+  }
+  for (int i = 0; i < 2; i++) {
+    fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL, 0) | O_NONBLOCK);  // 연결은 터널이 끝나면 닫힘
+  }
+
+  while (!(shut[0] && shut[1])) {
+    struct pollfd pfd[2] = {{.fd = fd1}, {.fd = fd2}};
+    for (int i = 0; i < 2; i++) {
+      if (!eof[i] && pending[i] == 0) pfd[i].events |= POLLIN;
+      if (pending[i] > 0) pfd[1 - i].events |= POLLOUT;
+    }
+    for (int i = 0; i < 2; i++) {
+      if (pfd[i].events == 0) pfd[i].fd = -1;  // 기다릴 일이 없는 소켓의 POLLHUP으로 헛돌지 않도록 제외
+    }
+    int ready = poll(pfd, 2, config.timeout_idle > 0 ? config.timeout_idle * 1000 : -1);
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready == 0) timeout_count(TO_IDLE);
+    if (ready <= 0) break;
+
+    for (int i = 0; i < 2; i++) {
+      ssize_t n;
+      if (!eof[i] && pending[i] == 0 && pfd[i].revents) {
+        n = splice(fds[i], NULL, pipes[i][1], NULL, RELAY_BUFSIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+          pending[i] = n;
+        } else if (n == 0 || errno != EAGAIN) {
+          eof[i] = 1;  // 읽기 에러(RST 등)도 이 방향의 끝으로 봄
+        }
+      }
+      if (pending[i] > 0) {  // 막 읽은 바이트도 바로 내보내 봄 (받는 쪽이 가득 차면 EAGAIN)
+        n = splice(pipes[i][0], NULL, fds[1 - i], NULL, pending[i], SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0 && errno != EAGAIN) goto done;  // 받는 쪽이 끊김: 더 보낼 곳이 없음
+        if (n > 0) {
+          pending[i] -= n;
+          total += n;
+        }
+      }
+      if (eof[i] && pending[i] == 0 && !shut[i]) {
+        shutdown(fds[1 - i], SHUT_WR);
+        shut[i] = 1;
+      }
+    }
+  }
+done:
+  for (int i = 0; i < 2; i++) {
+    close(pipes[i][0]);
+    close(pipes[i][1]);
+  }
+  return total;
+}
+
+void load_config(const char *path) {
+  FILE *fp = fopen(path, "r");
+  char line[MAXLINE], key[MAXLINE], value[MAXLINE];
+
+  if (fp == NULL) {
+    fprintf(stderr, "설정 파일을 열 수 없습니다: %s\n", path);
+    exit(1);
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    char *comment = strchr(line, '#');
+    if (comment) *comment = '\0';  // 주석 제거
+    if (sscanf(line, "%s %s", key, value) != 2) continue;  // 빈 줄 또는 값이 없는 줄은 무시
+
+    if (strcmp(key, "cache_sort_query") == 0) {
+      config.sort_query = (strcmp(value, "on") == 0);
+    } else if (strcmp(key, "cache_strip_param") == 0) {
+      if (config.nstrip < MAX_STRIP_PARAMS) {
+        config.strip_params[config.nstrip++] = strdup(value);
+      }
+    } else if (strcmp(key, "neg_ttl_dns") == 0) {
+      config.neg_ttl_dns = atoi(value);
+    } else if (strcmp(key, "neg_ttl_connect") == 0) {
+      config.neg_ttl_connect = atoi(value);
+    } else if (strcmp(key, "neg_ttl_status") == 0) {
+      config.neg_ttl_status = atoi(value);
+    } else if (strcmp(key, "cache_default_ttl") == 0) {
+      config.cache_default_ttl = atoi(value);
+    } else if (strcmp(key, "cache_stale_while_revalidate") == 0) {
+      config.cache_swr = atoi(value);
+    } else if (strcmp(key, "cache_stale_if_error") == 0) {
+      config.cache_sie = atoi(value);
+    } else if (strcmp(key, "refresh_threads") == 0) {
+      config.refresh_threads = atoi(value) > 0 ? atoi(value) : 1;
+    } else if (strcmp(key, "dns_ttl") == 0) {
+      config.dns_ttl = atoi(value);
+    } else if (strcmp(key, "dns_neg_ttl") == 0) {
+      config.dns_neg_ttl = atoi(value);
+    } else if (strcmp(key, "dns_refresh_ahead") == 0) {
+      config.dns_refresh_ahead = atoi(value);
+    } else if (strcmp(key, "connect_timeout") == 0) {
+      config.connect_timeout = atoi(value);
+    } else if (strcmp(key, "connect_delay") == 0) {
+      config.connect_delay = atoi(value);
+    } else if (strcmp(key, "timeout_header") == 0) {
+      config.timeout_header = atoi(value);
+    } else if (strcmp(key, "timeout_first_byte") == 0) {
+      config.timeout_first_byte = atoi(value);
+    } else if (strcmp(key, "timeout_idle") == 0) {
+      config.timeout_idle = atoi(value);
+    } else if (strcmp(key, "timeout_transfer") == 0) {
+      config.timeout_transfer = atoi(value);
+    } else if (strcmp(key, "zerocopy_min") == 0) {
+      config.zerocopy_min = atoi(value);
+    } else if (strcmp(key, "keepalive_timeout") == 0) {
+      config.keepalive_timeout = atoi(value);
+    } else if (strcmp(key, "keepalive_requests") == 0) {
+      config.keepalive_requests = atoi(value);
+    } else if (strcmp(key, "pipeline_depth") == 0) {
+      config.pipeline_depth = atoi(value);
+      if (config.pipeline_depth < 1) config.pipeline_depth = 1;  // 순서 큐 크기 안으로 제한
+      if (config.pipeline_depth > PIPELINE_MAX) config.pipeline_depth = PIPELINE_MAX;
+    } else if (strcmp(key, "pipeline_threads") == 0) {
+      config.pipeline_threads = atoi(value) > 0 ? atoi(value) : 1;
+    } else if (strcmp(key, "upstream_keepalive") == 0) {
+      config.upstream_keepalive = atoi(value);
+    } else if (strcmp(key, "upstream_idle_max") == 0) {
+      config.upstream_idle_max = atoi(value);
+      if (config.upstream_idle_max < 0) config.upstream_idle_max = 0;  // 풀 크기 안으로 제한
+      if (config.upstream_idle_max > UPSTREAM_IDLE_MAX) config.upstream_idle_max = UPSTREAM_IDLE_MAX;
+    } else if (strcmp(key, "upstream_fallback_ttl") == 0) {
+      config.upstream_fallback_ttl = atoi(value);
+    } else if (strcmp(key, "h2c") == 0) {
+      config.h2c = (strcmp(value, "on") == 0);
+    } else if (strcmp(key, "gzip") == 0) {
+      config.gzip = (strcmp(value, "on") == 0);
+    } else if (strcmp(key, "gzip_min") == 0) {
+      config.gzip_min = atoi(value);
+    } else if (strcmp(key, "gzip_level") == 0) {
+      config.gzip_level = atoi(value);
+      if (config.gzip_level < 1 || config.gzip_level > 9) config.gzip_level = GZIP_LEVEL;
+    } else if (strcmp(key, "request_header") == 0 || strcmp(key, "response_header") == 0) {
+      // "request_header <원 서버|*> <동작> <이름> [값]" (값은 줄 끝까지)
+      char origin[MAXLINE], action[MAXLINE], name[MAXLINE], *rest = NULL;
+      int off = -1;
+      sscanf(line, "%*s %s %s %s %n", origin, action, name, &off);
+      if (off >= 0) {
+        rest = line + off;
+        for (char *end = rest + strlen(rest); end > rest && isspace((unsigned char)end[-1]); ) *--end = '\0';
+      }
+      if (rest == NULL || hdr_rule_add(key[2] == 'q' ? HDR_REQUEST : HDR_RESPONSE, origin, action, name, rest) < 0) {
+        fprintf(stderr, "잘못된 헤더 규칙: %s %s\n", key, value);
+      }
+    } else if (strcmp(key, "listen_profile") == 0 || strcmp(key, "upstream_profile") == 0) {
+      if (!set_sock_profile(key[0] == 'l' ? &config.listen : &config.upstream, value)) {
+        fprintf(stderr, "알 수 없는 소켓 프로파일: %s\n", value);
+      }
+    } else if (strncmp(key, "listen_", 7) == 0 && set_sock_option(&config.listen, key + 7, value)) {
+      // 리스너 개별 옵션 (프로파일 뒤에 적으면 프로파일 값을 덮어씀)
+    } else if (strncmp(key, "upstream_", 9) == 0 && set_sock_option(&config.upstream, key + 9, value)) {
+      // 원 서버 연결 개별 옵션
+    } else {
+      fprintf(stderr, "알 수 없는 설정 항목: %s\n", key);
+    }
+  }
+  fclose(fp);
+}
+
+int set_sock_profile(sock_profile_t *prof, const char *name) {
+  static const sock_profile_t defaults = {0};
+  static const sock_profile_t latency = {.defer_accept = 1, .fastopen = 16, .nodelay = 1, .cork = 1};
+  static const sock_profile_t bulk = {.defer_accept = 1, .cork = 1, .sndbuf = 1 << 20, .rcvbuf = 1 << 20};
+
+  if (strcmp(name, "default") == 0) {
+    *prof = defaults;   // 커널 기본값 그대로
+  } else if (strcmp(name, "latency") == 0) {
+    *prof = latency;    // 작은 응답을 빨리: Nagle 끄고 헤더와 바디를 cork로 묶음
+  } else if (strcmp(name, "bulk") == 0) {
+    *prof = bulk;       // 큰 전송: 큰 버퍼로 대역폭 x 지연을 채움
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+int set_sock_option(sock_profile_t *prof, const char *opt, const char *value) {
+  if (strcmp(opt, "defer_accept") == 0) {
+    prof->defer_accept = atoi(value);
+  } else if (strcmp(opt, "fastopen") == 0) {
+    prof->fastopen = atoi(value);
+  } else if (strcmp(opt, "nodelay") == 0) {
+    prof->nodelay = atoi(value);
+  } else if (strcmp(opt, "cork") == 0) {
+    prof->cork = atoi(value);
+  } else if (strcmp(opt, "sndbuf") == 0) {
+    prof->sndbuf = atoi(value);
+  } else if (strcmp(opt, "rcvbuf") == 0) {
+    prof->rcvbuf = atoi(value);
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+// 실패해도 기본값으로 동작할 뿐이므로 경고만 출력
+static void set_opt(int fd, int level, int name, int value, const char *what) {
+  if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+    fprintf(stderr, "%s 설정 실패: %s\n", what, strerror(errno));
+  }
+}
+
+// 버퍼 크기와 TCP_NODELAY는 accept된 소켓이 리스너에서 상속받음
+void tune_listener(int listenfd) {
+  sock_profile_t *p = &config.listen;
+  if (p->defer_accept > 0) set_opt(listenfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, p->defer_accept, "TCP_DEFER_ACCEPT");
+  if (p->fastopen > 0) set_opt(listenfd, IPPROTO_TCP, TCP_FASTOPEN, p->fastopen, "TCP_FASTOPEN");
+  if (p->nodelay) set_opt(listenfd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  if (p->sndbuf > 0) set_opt(listenfd, SOL_SOCKET, SO_SNDBUF, p->sndbuf, "SO_SNDBUF");
+  if (p->rcvbuf > 0) set_opt(listenfd, SOL_SOCKET, SO_RCVBUF, p->rcvbuf, "SO_RCVBUF");
+}
+
+// SO_RCVBUF는 SYN의 윈도 스케일에 반영되도록 connect 전에 설정해야 함
+void tune_upstream(int fd) {
+  sock_profile_t *p = &config.upstream;
+  if (p->fastopen > 0) set_opt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1, "TCP_FASTOPEN_CONNECT");
+  if (p->nodelay) set_opt(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+  if (p->sndbuf > 0) set_opt(fd, SOL_SOCKET, SO_SNDBUF, p->sndbuf, "SO_SNDBUF");
+  if (p->rcvbuf > 0) set_opt(fd, SOL_SOCKET, SO_RCVBUF, p->rcvbuf, "SO_RCVBUF");
+}
+
+void set_cork(int fd, int on) {
+  setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+// 퍼센트 인코딩 해제해도 의미가 바뀌지 않는 문자 (RFC 3986 unreserved)
+static int is_unreserved(int c) {
+  return isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+// src[0..len)을 dst에 복사하면서 안전한 %XX는 디코딩, 나머지 %XX는 대문자 16진수로 통일 (dst == src 가능)
+static void decode_safe_escapes(const char *src, size_t len, char *dst) {
+  size_t i = 0;
+  while (i < len) {
+    if (src[i] == '%' && i + 2 < len && isxdigit((unsigned char)src[i + 1]) && isxdigit((unsigned char)src[i + 2])) {
+      char hex[3] = {src[i + 1], src[i + 2], '\0'};
+      int c = (int)strtol(hex, NULL, 16);
+      if (is_unreserved(c)) {
+        *dst++ = c;
+      } else {
+        *dst++ = '%';
+        *dst++ = toupper((unsigned char)src[i + 1]);
+        *dst++ = toupper((unsigned char)src[i + 2]);
+      }
+      i += 3;
+    } else {
+      *dst++ = src[i++];
+    }
+  }
+  *dst = '\0';
+}
+
+static int is_stripped_param(const char *param) {
+  size_t namelen = strcspn(param, "=");
+  for (int i = 0; i < config.nstrip; i++) {
+    if (strlen(config.strip_params[i]) == namelen && strncmp(param, config.strip_params[i], namelen) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int compare_params(const void *a, const void *b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+int normalize_uri(const char *uri, char *key, size_t keylen) {
+  // "HTTP://Example.COM:80/a%7Eb?utm_source=x&b=1#top" -> "http://example.com/a~b?b=1"
+  char tmp[MAXLINE], host[MAXLINE], port[MAXLINE], path[MAXLINE];
+  char decoded[MAXLINE], query[MAXLINE];
+  char *params[MAX_QUERY_PARAMS];
+  int nparams = 0;
+
+  if (strlen(uri) >= sizeof(tmp)) return -1;
+  strcpy(tmp, uri);
+
+  char *fragment = strchr(tmp, '#');
+  if (fragment) *fragment = '\0';  // 프래그먼트는 서버로 전송되지 않으므로 제거
+
+  if (parse_uri(tmp, host, port, path) == -1) return -1;
+
+  // 스킴과 호스트는 대소문자 구분 없음
+  for (char *c = host; *c; c++) {
+    *c = tolower((unsigned char)*c);
+  }
+
+  // 경로와 쿼리 분리 후 각각 안전한 이스케이프 디코딩
+  char *qs = strchr(path, '?');
+  if (qs) *qs++ = '\0';
+  decode_safe_escapes(path, strlen(path), decoded);
+
+  query[0] = '\0';
+  if (qs) {
+    char *save, *param;
+    strcpy(query, qs);
+    for (param = strtok_r(qs, "&", &save); param; param = strtok_r(NULL, "&", &save)) {
+      if (nparams == MAX_QUERY_PARAMS) break;
+      decode_safe_escapes(param, strlen(param), param);
+      if (is_stripped_param(param)) continue;  // 추적 파라미터 제거
+      params[nparams++] = param;
+    }
+    // 파라미터가 너무 많으면 정렬/제거 없이 원래 쿼리를 그대로 키에 씀 (요청을 거부하지 않음)
+    if (param == NULL) {
+      if (config.sort_query) {
+        qsort(params, nparams, sizeof(char *), compare_params);
+      }
+      char *q = query;
+      *q = '\0';
+      for (int i = 0; i < nparams; i++) {
+        if (i > 0) *q++ = '&';
+        strcpy(q, params[i]);
+        q += strlen(q);
+      }
+    }
+  }
+
+  // 기본 포트(80)는 생략
+  int n;
+  if (strcmp(port, "80") == 0 || port[0] == '\0') {
+    n = snprintf(key, keylen, "http://%s%s%s%s", host, decoded, query[0] ? "?" : "", query);
+  } else {
+    n = snprintf(key, keylen, "http://%s:%s%s%s%s", host, port, decoded, query[0] ? "?" : "", query);
+  }
+  return (n < 0 || (size_t)n >= keylen) ? -1 : 0;
+}
+
+void sbuf_init(sbuf_t *sp, int n) {
+  sp->buf = Calloc(n, sizeof(int));     // connfd 저장용 배열 할당
+  sp->n = n;                            // 버퍼 크기 저장
+  sp->front = sp->rear = 0;             // 초기 인덱스 0
+  pthread_mutex_init(&sp->mutex, NULL); // mutex 초기화
+  pthread_cond_init(&sp->slots, NULL);  // 빈 슬롯 대기 조건 변수 초기화
+  pthread_cond_init(&sp->items, NULL);  // 아이템 대기 조건 변수 초기화
+
+}
+
+void sbuf_insert(sbuf_t *sp, int item) {
+  pthread_mutex_lock(&sp->mutex);       // 큐 접근 mutext 잠금
+
+  while (((sp->rear + 1) % sp->n) == sp->front) { // 큐가 가득 찬 경우
+    pthread_cond_wait(&sp->slots, &sp->mutex);    // 빈 슬롯이 생길 때까지 대기
+  }
+
+  sp->buf[sp->rear] = item;           // connfd를 rear 위치에 저장
+  sp->rear = (sp->rear + 1) % sp->n;  // rear 인덱스 증가 (원형 회전)
+
+  pthread_cond_signal(&sp->items);    // 대기 중인 워커 스레드에게 작업이 생겼음을 알림
+  pthread_mutex_unlock(&sp->mutex);   // mutex 잠금 해제
+}
+
+void sbuf_insert_batch(sbuf_t *sp, int *items, int n) {
+  int i = 0;
+
+  pthread_mutex_lock(&sp->mutex);
+  while (i < n) {
+    while (((sp->rear + 1) % sp->n) == sp->front) { // 큐가 가득 찬 경우
+      pthread_cond_broadcast(&sp->items);           // 지금까지 넣은 것부터 처리하도록 깨움
+      pthread_cond_wait(&sp->slots, &sp->mutex);
+    }
+    // 빈 슬롯만큼 한꺼번에 복사
+    while (i < n && ((sp->rear + 1) % sp->n) != sp->front) {
+      sp->buf[sp->rear] = items[i++];
+      sp->rear = (sp->rear + 1) % sp->n;
+    }
+  }
+  if (n == 1) {
+    pthread_cond_signal(&sp->items);
+  } else {
+    pthread_cond_broadcast(&sp->items); // 여러 개를 넣었으므로 대기 중인 워커를 모두 깨움
+  }
+  pthread_mutex_unlock(&sp->mutex);
+}
+
+int sbuf_remove(sbuf_t *sp) {
+  pthread_mutex_lock(&sp->mutex); // 큐 접근 잠금
+
+  while (sp->front == sp->rear) { // 큐가 비어있는 경우
+    pthread_cond_wait(&sp->items, &sp->mutex);  // 아이템이 들어올 때까지 대기
+  }
+
+  int item = sp->buf[sp->front];        // front 위치의 connfd 가져오기
+  sp->front = (sp->front + 1) % sp->n;  // front 인덱스 증가 (원형 회전)
+
+  pthread_cond_signal(&sp->slots);      // 대기 중인 메인 스레드에게 공간이 생겼음을 알림
+  pthread_mutex_unlock(&sp->mutex);     // 잠금 해제
+
+  return item;  // connfd 반환
+}
+
+void pool_init(pool_t *pp, int nthreads, int n) {
+  pp->buf = Calloc(n, sizeof(job_t));
+  pp->n = n;
+  pp->front = pp->rear = 0;
+  pthread_mutex_init(&pp->mutex, NULL);
+  pthread_cond_init(&pp->items, NULL);
+
+  pthread_t tid;
+  for (int i = 0; i < nthreads; i++) {
+    pthread_create(&tid, NULL, pool_thread, pp);
+  }
+}
+
+int pool_submit(pool_t *pp, void (*fn)(void *), void *arg) {
+  pthread_mutex_lock(&pp->mutex);
+
+  if (((pp->rear + 1) % pp->n) == pp->front) {  // 큐가 가득 찬 경우 기다리지 않고 거절
+    pthread_mutex_unlock(&pp->mutex);
+    return 0;
+  }
+
+  pp->buf[pp->rear].fn = fn;
+  pp->buf[pp->rear].arg = arg;
+  pp->rear = (pp->rear + 1) % pp->n;
+
+  pthread_cond_signal(&pp->items);
+  pthread_mutex_unlock(&pp->mutex);
+  return 1;
+}
+
+void *pool_thread(void *vargp) {
+  pool_t *pp = vargp;
+  pthread_detach(pthread_self());
+
+  while (1) {
+    pthread_mutex_lock(&pp->mutex);
+    while (pp->front == pp->rear) {
+      pthread_cond_wait(&pp->items, &pp->mutex);
+    }
+    job_t job = pp->buf[pp->front];
+    pp->front = (pp->front + 1) % pp->n;
+    pthread_mutex_unlock(&pp->mutex);
+
+    job.fn(job.arg);
+  }
+}
+
+void *thread(void *vargp) {
+  pthread_detach(pthread_self()); // 스레드 자원 자동 회수
+
+  while (1) {
+    int connfd = sbuf_remove(&sbuf);  // 작업 큐에서 connfd 꺼내기
+    func(connfd);                     // 요청 처리 함수 호출
+    close(connfd);                    // 클라이언트와의 연결 종료
+  }
+}
+
+pipelined_t *pipeline_dispatch(client_req_t *creq, int body_fd) {
+  char key[MAXLINE];
+  pipelined_t *p = Malloc(sizeof(pipelined_t));
+
+  p->req = *creq;
+  p->node = NULL;
+  p->fd[0] = p->fd[1] = -1;
+  p->body_fd = body_fd;
+  p->close = 0;
+  p->refcnt = 1;
+
+  // 신선한 캐시 적중: 노드 참조만 들고 있다가 차례가 오면 연결 스레드가 바로 전송
+  //    gzip을 받는 클라이언트에게는 gzip 변형을, 변형이 없고 원본을 압축할 수 있으면 처리 스레드가 만들게 함
+  if (creq->status == 0 && body_fd < 0 && strcmp(creq->method, "GET") == 0 &&
+      normalize_uri(creq->uri, key, sizeof(key)) == 0) {
+    int want_gzip = creq->gzip_ok && creq->range[0] == '\0';
+    cache_node_t *node = want_gzip ? gzip_variant(key, 0) : NULL;
+    if (node == NULL) node = lookup_cache(&cache, key);
+    if (node && (node->expires == 0 || time(NULL) < node->expires) && !(want_gzip && node->compressible)) {
+      p->node = node;
+      __atomic_add_fetch(&pipeline_hits, 1, __ATOMIC_RELAXED);
+      return p;
+    }
+    if (node) release_cache(node);
+  }
+
+  // 그 외: 처리 스레드가 앞선 응답과 동시에 만들어 파이프에 씀 (파이프가 차면 차례가 올 때까지 대기)
+  //    작업은 넣은 순서대로 꺼내므로 연결마다 가장 앞선 요청이 먼저 스레드를 얻어, 파이프에서 막힌 스레드끼리 서로 기다리지 않음
+  if (pipe(p->fd) < 0) {
+    free(p);
+    return NULL;
+  }
+  p->refcnt = 2;
+  if (!pool_submit(&pipeline_pool, pipeline_job, p)) {
+    close(p->fd[0]);
+    close(p->fd[1]);
+    free(p);
+    errno = EBUSY;
+    return NULL;
+  }
+  return p;
+}
+
+void pipeline_job(void *vargp) {
+  pipelined_t *p = vargp;
+  rio_t body_rio;
+
+  if (p->body_fd >= 0) rio_readinitb(&body_rio, p->body_fd);  // HTTP/2 요청 바디 (연결 스레드가 DATA 프레임을 풀어 씀)
+  int close_after = serve_request(p->fd[1], &p->req, p->body_fd >= 0 ? &body_rio : NULL);
+  __atomic_store_n(&p->close, close_after, __ATOMIC_RELEASE);  // 파이프를 닫기 전에 기록 (EOF를 본 쪽이 읽음)
+  close(p->fd[1]);
+  if (p->body_fd >= 0) close(p->body_fd);
+  release_pipelined(p);
+}
+
+int forward_pipelined(int connfd, pipelined_t *p) {
+  char buf[MAXBUF];
+  ssize_t n;
+  int rc;
+  timeout_t transfer_to;
+
+  timeout_start(&transfer_to, TO_TRANSFER, config.timeout_transfer * 1000, connfd, -1);  // 느린 클라이언트로의 전송 제한
+  if (p->node) {
+    resp_state.keep_alive = p->req.keep_alive;
+    resp_state.close = 0;
+    resp_state.sock = 1;
+    if (send_cached(connfd, p->node, p->req.range) < 0) {
+      rc = -1;  // 뒤에 쌓인 응답도 보낼 수 없으므로 연결을 닫게 함
+    } else {
+      rc = !resp_state.keep_alive || resp_state.close;
+    }
+  } else {
+    while ((n = read(p->fd[0], buf, sizeof(buf))) != 0) {
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0 || rio_writen(connfd, buf, n) < 0) break;
+    }
+    rc = n != 0 ? -1 : __atomic_load_n(&p->close, __ATOMIC_ACQUIRE);  // EOF: 처리 스레드가 기록을 마침
+  }
+  if (timeout_cancel(&transfer_to)) rc = -1;
+  return rc;
+}
+
+void release_pipelined(pipelined_t *p) {
+  if (__atomic_sub_fetch(&p->refcnt, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+  free(p->req.hdrs);
+  if (p->node) release_cache(p->node);
+  free(p);
+}
+
+void cache_init(cache_t *cache) {
+  cache->head = NULL;
+  cache->tail = NULL;
+  cache->total_size = 0;
+  pthread_rwlock_init(&cache->lock, NULL);
+}
+
+int find_cache_and_send(int connfd, cache_t *cache, const char *uri, const char *range,
+                        cache_node_t **stale) {
+  cache_node_t *node = lookup_cache(cache, uri);
+  if (node == NULL) return 0;  // miss
+
+  time_t now = time(NULL);
+  if (node->expires == 0 || now < node->expires) {
+    send_cached(connfd, node, range);   // 신선한 노드: 캐시 락을 잡지 않은 상태로 전송
+    release_cache(node);
+    return 1;  // hit
+  }
+  if (now < node->swr_until) {
+    send_cached(connfd, node, range);   // stale-while-revalidate: 만료된 응답을 바로 보내고 백그라운드에서 갱신
+    schedule_refresh(node);
+    release_cache(node);
+    return 1;  // hit
+  }
+  if (now < node->sie_until) {
+    *stale = node;  // stale-if-error: 원 서버가 실패하면 이 노드로 응답 (참조는 호출자가 해제)
+    return 0;
+  }
+  release_cache(node);
+  return 0; // miss
+}
+
+cache_node_t *lookup_cache(cache_t *cache, const char *uri) {
+  pthread_rwlock_rdlock(&cache->lock);
+  cache_node_t *node = cache->head;
+  while (node) {
+      if (strcmp(node->uri, uri) == 0) {
+          __atomic_add_fetch(&node->refcnt, 1, __ATOMIC_RELAXED);  // 읽기 락끼리는 동시 실행되므로 원자적으로 증가
+          break;
+      }
+      node = node->next;
+  }
+  pthread_rwlock_unlock(&cache->lock);
+  return node;
+}
+
+void release_cache(cache_node_t *node) {
+  if (__atomic_sub_fetch(&node->refcnt, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+  // 캐시에서 제거되었고 전송 중인 스레드도 없음
+  free(node->uri);
+  free(node->hdr);
+  free(node->data);
+  free(node);
+}
+
+// 캐시 적중 응답에서 요청마다 달라지는 헤더를 head에 만들고, 바디로 보낼 구간을 [*first, *last]에 돌려줌
+// 전체 응답이면 저장된 헤더 뒤에 붙일 줄만 만들고 0, 범위 응답(206, 416)이면 상태 줄부터 전부 만들고 1 반환
+static int cached_head(cache_node_t *node, const char *range, char *head, size_t cap, int *head_size,
+                       long *first, long *last) {
+  int rc = -1, n;
+
+  if (range && range[0] && node->status == 200) {
+    rc = parse_range(range, node->data_size, first, last);
+  }
+
+  long age = node->age + (long)(time(NULL) - node->stored);
+  if (rc == -1) {
+    *first = 0;
+    *last = node->data_size - 1;
+    n = snprintf(head, cap, "Age: %ld\r\nX-Cache: HIT\r\n", age);
+    if (!node->has_length && node->status != 204 && node->status != 304) {  // keep-alive 연결에서는 길이가 있어야 함
+      n += snprintf(head + n, cap - n, "Content-Length: %d\r\n", node->data_size);
+    }
+    *head_size = n + snprintf(head + n, cap - n, "%s\r\n", conn_header());
+    return 0;
+  }
+
+  if (rc == 0) {  // 만족할 수 없는 범위
+    *first = 0;
+    *last = -1;
+    *head_size = snprintf(head, cap, "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                          "Content-Range: bytes */%d\r\nContent-Length: 0\r\n"
+                          "X-Cache: HIT\r\n%s\r\n", node->data_size, conn_header());
+    return 1;
+  }
+
+  // 부분 응답: 상태 줄과 Content-Length만 바꾼 헤더
+  n = sprintf(head, "HTTP/1.1 206 Partial Content\r\n");
+  char *end = node->hdr + node->hdr_size;
+  char *line = memchr(node->hdr, '\n', node->hdr_size);  // 상태 줄 다음부터 복사
+  for (line = line ? line + 1 : end; line < end; ) {
+    char *next = memchr(line, '\n', end - line);
+    next = next ? next + 1 : end;
+    if (line_header_id(line, next - line) != HTTP_H_CONTENT_LENGTH) {
+      memcpy(head + n, line, next - line);
+      n += next - line;
+    }
+    line = next;
+  }
+  *head_size = n + snprintf(head + n, cap - n,
+                            "Content-Range: bytes %ld-%ld/%d\r\nContent-Length: %ld\r\n"
+                            "Age: %ld\r\nX-Cache: HIT\r\n%s\r\n",
+                            *first, *last, node->data_size, *last - *first + 1, age, conn_header());
+  return 1;
+}
+
+int send_cached(int connfd, cache_node_t *node, const char *range) {
+  static __thread char head[MAXBUF + MAXLINE];  // 응답마다 달라지는 헤더를 만드는 스레드별 버퍼
+  struct iovec iov[3];
+  long first, last;
+  int head_size, n = 0, rc;
+
+  // 전체 응답이면 저장된 헤더와 바디는 복사하지 않고 그대로 전송, 범위 응답이면 바디는 해당 범위만
+  if (!cached_head(node, range, head, sizeof(head), &head_size, &first, &last)) {
+    iov[n].iov_base = node->hdr;
+    iov[n++].iov_len = node->hdr_size;
+  }
+  iov[n].iov_base = head;
+  iov[n++].iov_len = head_size;
+  iov[n].iov_base = node->data + first;
+  iov[n++].iov_len = last - first + 1;
+  if (config.zerocopy_min > 0 && last - first + 1 >= config.zerocopy_min && resp_state.sock) {
+    rc = send_zerocopy(connfd, iov, n);
+  } else {
+    rc = rio_writev(connfd, iov, n) < 0 ? -1 : 0;
+  }
+  // 응답이 잘렸거나 zerocopy 제한 시간 초과로 connfd가 /dev/null로 바뀜: 이 연결에는 더 보낼 수 없음
+  if (rc < 0) resp_state.close = 1;
+  return rc;
+}
+
+// 에러 큐에서 MSG_ZEROCOPY 완료 알림을 읽어 완료된 sendmsg 호출 수를 반환 (없으면 0)
+static int reap_zerocopy(int connfd) {
+  char control[128];
+  struct msghdr msg = {.msg_control = control, .msg_controllen = sizeof(control)};
+  struct cmsghdr *cm;
+  int done = 0;
+
+  if (recvmsg(connfd, &msg, MSG_ERRQUEUE) < 0) {
+    int err;
+    socklen_t len = sizeof(err);
+    getsockopt(connfd, SOL_SOCKET, SO_ERROR, &err, &len);  // 소켓 에러로 POLLERR이 계속 뜨지 않도록 비움
+    return 0;
+  }
+  for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+    struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cm);
+    if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+    done += serr->ee_data - serr->ee_info + 1;  // [ee_info, ee_data] 범위의 호출이 완료됨
+    if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+      __atomic_add_fetch(&zc_copied, 1, __ATOMIC_RELAXED);
+    }
+  }
+  return done;
+}
+
+// 커널이 페이지를 직접 참조하므로 완료 알림을 다 받기 전에는 돌아가지 않음
+// (호출자가 들고 있는 캐시 노드 참조가 그동안 바디 메모리를 유지)
+int send_zerocopy(int connfd, struct iovec *iov, int iovcnt) {
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+  int on = 1, calls = 0, done = 0, rc = 0;
+
+  if (__atomic_load_n(&zc_disabled, __ATOMIC_RELAXED) || setsockopt(connfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+    __atomic_store_n(&zc_disabled, 1, __ATOMIC_RELAXED);  // 지원하지 않는 커널: 이후로는 일반 전송
+    return rio_writev(connfd, iov, iovcnt) < 0 ? -1 : 0;
+  }
+
+  while (msg.msg_iovlen > 0) {
+    ssize_t n = sendmsg(connfd, &msg, MSG_ZEROCOPY);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == ENOBUFS) {  // 고정할 수 있는 메모리 한도 초과: 남은 부분은 복사해서 전송
+        rc = rio_writev(connfd, msg.msg_iov, msg.msg_iovlen) < 0 ? -1 : 0;
+      } else {
+        rc = -1;
+      }
+      break;
+    }
+    calls++;  // 성공한 호출마다 완료 알림 번호가 하나씩 매겨짐
+    while (n > 0 && (size_t)n >= msg.msg_iov->iov_len) {  // 다 보낸 iovec 건너뛰기
+      n -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
+    }
+    if (n > 0) {
+      msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+      msg.msg_iov->iov_len -= n;
+    }
+  }
+  if (calls > 0) {
+    __atomic_add_fetch(&zc_sends, 1, __ATOMIC_RELAXED);
+  }
+
+  // 완료 알림 대기: POLLERR은 events에 넣지 않아도 보고됨
+  struct pollfd pfd = {.fd = connfd, .events = 0};
+  while (done < calls) {
+    int ready = poll(&pfd, 1, config.timeout_idle > 0 ? config.timeout_idle * 1000 : -1);
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready <= 0) {
+      // 클라이언트가 ACK하지 않음: 참조를 놓기 전에 RST로 끊어 송신 큐의 페이지를 해제
+      // dup2로 소켓만 닫고 fd 번호는 호출자가 나중에 close하도록 남겨 둠
+      struct linger lg = {.l_onoff = 1, .l_linger = 0};
+      int nullfd = open("/dev/null", O_RDWR);
+      setsockopt(connfd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+      if (nullfd >= 0) {
+        dup2(nullfd, connfd);
+        close(nullfd);
+      }
+      __atomic_add_fetch(&zc_aborted, 1, __ATOMIC_RELAXED);
+      return -1;
+    }
+    done += reap_zerocopy(connfd);
+  }
+  return rc;
+}
+
+cache_node_t *insert_cache(cache_t *cache, const char *uri, const resp_info_t *info, const char *hdr, int hdr_size,
+                           const char *data, int data_size) {
+  int size = hdr_size + data_size;
+
+  pthread_rwlock_wrlock(&cache->lock); // 캐시 접근 보호(동기화)
+
+  // 같은 키의 기존 노드(만료된 노드 포함)는 제거 후 교체
+  for (cache_node_t *old = cache->head; old; old = old->next) {
+    if (strcmp(old->uri, uri) == 0) {
+      unlink_cache(cache, old);
+      break;
+    }
+  }
+
+  // 필요한 공간 확보. 초과한 경우 맨 뒤 노드를 제거
+  while (cache->total_size + size > MAX_CACHE_SIZE) {
+    evict_cache(cache);
+  }
+
+  // 새로운 노드 생성
+  cache_node_t *node = Malloc(sizeof(cache_node_t));
+  node->uri = Malloc(strlen(uri) + 1);  // 널 문자가 없을 수도 있으므로 +1 할당
+  strcpy(node->uri, uri);
+
+  node->hdr = Malloc(hdr_size);
+  memcpy(node->hdr, hdr, hdr_size);
+  node->hdr_size = hdr_size;
+  node->data = Malloc(data_size > 0 ? data_size : 1);
+  memcpy(node->data, data, data_size);
+  node->data_size = data_size;
+  node->size = size;
+  node->status = info->status;
+  node->has_length = info->content_length >= 0;
+  node->compressible = info->status == 200 && info->compressible && !info->encoded && data_size >= config.gzip_min;
+  node->age = info->age;
+  node->stored = time(NULL);
+  node->refreshing = 0;
+
+  // 신선도: 4xx/5xx는 네거티브 TTL, 그 외에는 max-age 또는 기본 TTL (0이면 만료 없음)
+  node->expires = 0;
+  node->swr_until = node->sie_until = 0;
+  if (info->status >= 400) {
+    node->expires = node->stored + config.neg_ttl_status;
+  } else if (info->max_age >= 0 || config.cache_default_ttl > 0) {
+    int ttl = info->max_age >= 0 ? info->max_age : config.cache_default_ttl;
+    node->expires = node->stored + (ttl > info->age ? ttl - info->age : 0);
+    node->swr_until = node->expires + (info->swr >= 0 ? info->swr : config.cache_swr);
+    node->sie_until = node->expires + (info->sie >= 0 ? info->sie : config.cache_sie);
+  }
+  node->refcnt = 2;  // 캐시 리스트가 가진 참조 + 호출자에게 돌려줄 참조
+
+  // 리스트 앞에 삽입
+  node->prev = NULL;
+  node->next = cache->head;
+  if (cache->head) {
+    cache->head->prev = node;
+  }
+  cache->head = node;
+
+  if (cache->tail == NULL) {  
+    cache->tail = node; // 첫 노드라면 tail로도 설정
+  }
+
+  cache->total_size += size;  // 데이터 양만큼 전체 데이터 크기 증가
+  pthread_rwlock_unlock(&cache->lock); // 캐시 접근 보호 해제(동기화 해제)
+  return node;
+}
+
+void invalidate_cache(cache_t *cache, const char *uri) {
+  pthread_rwlock_wrlock(&cache->lock);
+  for (cache_node_t *node = cache->head; node; node = node->next) {
+    if (strcmp(node->uri, uri) == 0) {
+      unlink_cache(cache, node);  // 전송 중인 스레드가 있다면 마지막 전송 후 해제됨
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&cache->lock);
+}
+
+void evict_cache(cache_t *cache) {
+  if (cache->tail == NULL) return;
+
+  unlink_cache(cache, cache->tail);
+}
+
+void unlink_cache(cache_t *cache, cache_node_t *node) {
+  // 리스트에서 제거
+  if (node->prev) {
+    node->prev->next = node->next;
+  } else {
+    cache->head = node->next;
+  }
+  if (node->next) {
+    node->next->prev = node->prev;
+  } else {
+    cache->tail = node->prev;
+  }
+
+  // 데이터 양만큼 전체 데이터 크기 감소 후 리스트의 참조 해제 (전송 중이라면 마지막 전송 후 해제됨)
+  cache->total_size -= node->size;
+  release_cache(node);
+}
+
+// Accept-Encoding의 gzip(x-gzip) 또는 * 항목을 찾음. q 값에 0이 아닌 숫자가 없으면(q=0, q=0.000) 거부로 봄
+int accepts_gzip(const char *value, size_t len) {
+  const char *end = value + len;
+  int gzip = -1, star = 0;  // gzip이 따로 적혀 있으면 *보다 우선
+
+  while (value < end) {
+    while (value < end && (*value == ' ' || *value == '\t' || *value == ',')) value++;
+    const char *tok = value;
+    while (value < end && *value != ',' && *value != ';' && *value != ' ' && *value != '\t') value++;
+    size_t tlen = value - tok;
+    const char *params = value;
+    while (value < end && *value != ',') value++;
+
+    int ok = 1;
+    const char *q = memchr(params, '=', value - params);
+    if (q && q > params && (q[-1] == 'q' || q[-1] == 'Q')) {
+      for (ok = 0, q++; q < value && *q != ';' && *q != ' '; q++) {
+        if (*q >= '1' && *q <= '9') ok = 1;
+      }
+    }
+    if ((tlen == 4 && strncasecmp(tok, "gzip", 4) == 0) || (tlen == 6 && strncasecmp(tok, "x-gzip", 6) == 0)) {
+      gzip = ok;
+    } else if (tlen == 1 && *tok == '*') {
+      star = ok;
+    }
+  }
+  return gzip >= 0 ? gzip : star;
+}
+
+// 이미 압축된 이미지나 동영상은 제외하고 텍스트로 된 형식만
+int is_compressible_type(const char *value) {
+  static const char *types[] = {"application/json", "application/javascript", "application/x-javascript",
+                                "application/xml", "application/xhtml+xml", "image/svg+xml"};
+
+  while (*value == ' ' || *value == '\t') value++;
+  size_t len = strcspn(value, "; \t\r\n");
+  if (len > 5 && strncasecmp(value, "text/", 5) == 0) return 1;
+  if ((len > 5 && strncasecmp(value + len - 5, "+json", 5) == 0) ||
+      (len > 4 && strncasecmp(value + len - 4, "+xml", 4) == 0)) {
+    return 1;
+  }
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    if (strlen(types[i]) == len && strncasecmp(value, types[i], len) == 0) return 1;
+  }
+  return 0;
+}
+
+int gzip_key(const char *uri_key, char *key) {
+  return snprintf(key, MAXLINE, "%s%s", uri_key, GZIP_KEY_SUFFIX) < MAXLINE ? 0 : -1;
+}
+
+// 줄마다 복사하면서 Content-Length는 빼고(length가 0 이상이면 끝에 새 값으로), 강한 ETag는 같은 바이트가 아니므로 약하게,
+// Vary에는 Accept-Encoding을 더함. hdr은 "\r\n"으로 끝나는 줄의 나열 (빈 줄 없음)
+int gzip_header(const char *hdr, int size, char *out, long length) {
+  const char *line = hdr, *end = hdr + size;
+  int n = 0, vary = 0;
+
+  while (line < end) {
+    const char *next = memchr(line, '\n', end - line);
+    next = next ? next + 1 : end;
+    size_t len = next - line, name_len = http_name_len(line, len);
+    int id = name_len < len ? http_header_id(line, name_len) : HTTP_H_OTHER;
+    const char *value = line + name_len + 1;
+    while (value < next && (*value == ' ' || *value == '\t')) value++;
+
+    if (id == HTTP_H_CONTENT_LENGTH) {
+      line = next;
+      continue;
+    }
+    if (id == HTTP_H_ETAG && value < next && *value == '"') {
+      n += sprintf(out + n, "ETag: W/");
+      memcpy(out + n, value, next - value);
+      n += next - value;
+    } else if (id == HTTP_H_VARY && len >= 2 && line[len - 2] == '\r') {
+      memcpy(out + n, line, len - 2);
+      n += len - 2;
+      n += sprintf(out + n, ", Accept-Encoding\r\n");
+      vary = 1;
+    } else {
+      memcpy(out + n, line, len);
+      n += len;
+    }
+    line = next;
+  }
+  n += sprintf(out + n, "Content-Encoding: gzip\r\n%s", vary ? "" : "Vary: Accept-Encoding\r\n");
+  if (length >= 0) n += sprintf(out + n, "Content-Length: %ld\r\n", length);
+  return n;
+}
+
+// gzip 변형은 원본의 만료 시각을 그대로 물려받고 stale 기간은 없음
+//    만료된 변형은 쓰지 않고, 원본이 갱신되어 신선해지면 다음 요청이 새 원본으로 다시 만듦
+//    압축해도 작아지지 않으면 만들지 않음 (원본을 그대로 보냄)
+cache_node_t *gzip_variant(const char *uri_key, int make) {
+  char key[MAXLINE];
+  time_t now = time(NULL);
+
+  if (gzip_key(uri_key, key) < 0) return NULL;
+  cache_node_t *node = lookup_cache(&cache, key);
+  if (node && (node->expires == 0 || now < node->expires)) return node;
+  if (node) release_cache(node);
+  if (!make) return NULL;
+
+  cache_node_t *src = lookup_cache(&cache, uri_key);
+  if (src == NULL) return NULL;
+  node = NULL;
+  if (src->compressible && (src->expires == 0 || now < src->expires) && src->hdr_size + 128 <= MAXBUF) {
+    z_stream zs = {0};
+    char *gz = Malloc(src->data_size);
+    int gz_size = -1;
+    if (deflateInit2(&zs, config.gzip_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+      zs.next_in = (Bytef *)src->data;
+      zs.avail_in = src->data_size;
+      zs.next_out = (Bytef *)gz;
+      zs.avail_out = src->data_size;
+      if (deflate(&zs, Z_FINISH) == Z_STREAM_END) gz_size = zs.total_out;  // 출력이 원본보다 크면 Z_OK에서 멈춤
+      deflateEnd(&zs);
+    }
+    if (gz_size > 0) {
+      resp_info_t info = {.status = src->status, .content_length = gz_size, .encoded = 1, .gzipped = 1};
+      char *hdr = Malloc(src->hdr_size + 128);
+      int hdr_size = gzip_header(src->hdr, src->hdr_size, hdr, gz_size);
+      info.age = src->age + (int)(now - src->stored);
+      info.max_age = src->expires ? (int)(src->expires - now) + info.age : -1;
+      node = insert_cache(&cache, key, &info, hdr, hdr_size, gz, gz_size);
+      free(hdr);
+      __atomic_add_fetch(&gzip_variants, 1, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&gzip_in, src->data_size, __ATOMIC_RELAXED);
+      __atomic_add_fetch(&gzip_out, gz_size, __ATOMIC_RELAXED);
+    }
+    free(gz);
+  }
+  release_cache(src);
+  return node;
+}
+
+int open_upstream(int connfd, upstream_t *up, const char *req, cache_node_t *stale, const char *range) {
+  // 유휴 연결 재사용: 쓰기가 실패하면 원 서버가 닫은 연결이므로 버리고 다음 연결
+  up->reused = 0;
+  while (!up->once && (up->fd = upstream_get(up->host, up->port)) >= 0) {
+    if (rio_writen(up->fd, (void *)req, strlen(req)) >= 0) {
+      up->reused = 1;
+      __atomic_add_fetch(&upstream_reuses, 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+    close(up->fd);
+  }
+
+  if ((up->fd = connect_origin(connfd, up->host, up->port, stale, range)) < 0) return -1;
+  if (rio_writen(up->fd, (void *)req, strlen(req)) < 0) {  // 요청 전체 전송
+    close(up->fd);
+    origin_failed(connfd, stale, range, "Proxy couldn't send the request to the origin");
+    return -1;
+  }
+  return 0;
+}
+
+// 재사용한 연결이 응답 없이 끊겼다면 원 서버가 유휴 연결을 먼저 닫은 것이므로 새 연결로 다시 보내고,
+// 새 연결에서도 HTTP/1.1 요청에 올바른 응답이 없다면 그 원 서버를 HTTP/1.0으로 기억하고 다시 보냄
+int finish_upstream(upstream_t *up, int result) {
+  if (result == UP_REUSE && !up->http10) {
+    upstream_put(up->host, up->port, up->fd);
+    return 0;
+  }
+  close(up->fd);
+  if (result != UP_RETRY || up->once) return 0;
+  if (up->reused) return 1;
+  if (up->http10) return 0;  // HTTP/1.0으로도 실패: 호출자가 502로 응답
+  up->http10 = 1;
+  neg_insert(up->host, up->port, NEG_HTTP10);
+  __atomic_add_fetch(&upstream_fallbacks, 1, __ATOMIC_RELAXED);
+  fprintf(stderr, "원 서버가 HTTP/1.1 요청을 처리하지 못함, HTTP/1.0으로 재시도: %s:%s\n", up->host, up->port);
+  return 1;
+}
+
+int upstream_get(const char *host, const char *port) {
+  time_t now = time(NULL);
+  int fd = -1;
+
+  pthread_mutex_lock(&upstream_pool.mutex);
+  for (int i = upstream_pool.n - 1; i >= 0 && fd < 0; i--) {
+    idle_conn_t *c = &upstream_pool.conns[i];
+    int expired = now - c->since >= config.upstream_keepalive;
+    if (!expired && (strcmp(c->host, host) != 0 || strcmp(c->port, port) != 0)) continue;
+
+    // 꺼내거나 만료된 연결은 풀에서 빼고 뒤의 연결을 당김
+    int cfd = c->fd;
+    memmove(c, c + 1, (upstream_pool.n - i - 1) * sizeof(*c));
+    upstream_pool.n--;
+    if (expired) {
+      close(cfd);
+      continue;
+    }
+    // 유휴 상태에서 읽을 것이 있다면 원 서버가 닫았거나(EOF) 요청하지 않은 바이트를 보낸 것
+    struct pollfd pfd = {.fd = cfd, .events = POLLIN};
+    if (poll(&pfd, 1, 0) != 0) {
+      close(cfd);
+      continue;
+    }
+    fd = cfd;
+  }
+  pthread_mutex_unlock(&upstream_pool.mutex);
+  return fd;
+}
+
+void upstream_put(const char *host, const char *port, int fd) {
+  if (config.upstream_keepalive <= 0 || config.upstream_idle_max <= 0 ||
+      strlen(host) >= sizeof(upstream_pool.conns[0].host) || strlen(port) >= sizeof(upstream_pool.conns[0].port)) {
+    close(fd);
+    return;
+  }
+
+  pthread_mutex_lock(&upstream_pool.mutex);
+  if (upstream_pool.n == config.upstream_idle_max) {  // 가장 오래 쉰 연결을 닫고 자리를 만듦
+    close(upstream_pool.conns[0].fd);
+    memmove(&upstream_pool.conns[0], &upstream_pool.conns[1], (upstream_pool.n - 1) * sizeof(idle_conn_t));
+    upstream_pool.n--;
+  }
+  idle_conn_t *c = &upstream_pool.conns[upstream_pool.n++];
+  snprintf(c->host, sizeof(c->host), "%s", host);
+  snprintf(c->port, sizeof(c->port), "%s", port);
+  c->fd = fd;
+  c->since = time(NULL);
+  pthread_mutex_unlock(&upstream_pool.mutex);
+}
+
+int neg_lookup(const char *host, const char *port) {
+  int kind = NEG_NONE;
+  time_t now = time(NULL);
+
+  pthread_mutex_lock(&neg_cache.mutex);
+  for (int i = 0; i < NEG_ORIGINS; i++) {
+    neg_origin_t *e = &neg_cache.entries[i];
+    if (e->expires > now && strcmp(e->host, host) == 0 && strcmp(e->port, port) == 0) {
+      kind = e->kind;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&neg_cache.mutex);
+  return kind;
+}
+
+void neg_insert(const char *host, const char *port, int kind) {
+  int ttl = kind == NEG_DNS ? config.neg_ttl_dns
+          : kind == NEG_CONNECT ? config.neg_ttl_connect : config.upstream_fallback_ttl;
+  if (ttl <= 0) return;  // TTL 0이면 기억하지 않음
+
+  pthread_mutex_lock(&neg_cache.mutex);
+  // 같은 원 서버 또는 만료된 슬롯을 재사용, 없다면 가장 먼저 만료될 슬롯을 덮어씀
+  neg_origin_t *slot = &neg_cache.entries[0];
+  for (int i = 0; i < NEG_ORIGINS; i++) {
+    neg_origin_t *e = &neg_cache.entries[i];
+    if (strcmp(e->host, host) == 0 && strcmp(e->port, port) == 0) {
+      slot = e;
+      break;
+    }
+    if (e->expires < slot->expires) {
+      slot = e;
+    }
+  }
+  snprintf(slot->host, sizeof(slot->host), "%s", host);
+  snprintf(slot->port, sizeof(slot->port), "%s", port);
+  slot->kind = kind;
+  slot->expires = time(NULL) + ttl;
+  pthread_mutex_unlock(&neg_cache.mutex);
+}
+
+typedef struct {
+  cache_node_t *node;   // 갱신할 (만료된) 노드
+} refresh_task_t; // 백그라운드 갱신 작업
+
+void schedule_refresh(cache_node_t *node) {
+  if (__atomic_exchange_n(&node->refreshing, 1, __ATOMIC_ACQ_REL)) return;  // 이미 갱신 중인 키
+
+  refresh_task_t *task = Malloc(sizeof(refresh_task_t));
+  __atomic_add_fetch(&node->refcnt, 1, __ATOMIC_RELAXED);  // 갱신이 끝날 때까지 노드 유지
+  task->node = node;
+  if (!pool_submit(&refresh_pool, refresh_entry, task)) {
+    // 동시 갱신 한도 초과: 다음 요청이 다시 시도하도록 표시 해제
+    __atomic_store_n(&node->refreshing, 0, __ATOMIC_RELEASE);
+    release_cache(node);
+    free(task);
+  }
+}
+
+void refresh_entry(void *vargp) {
+  refresh_task_t *task = vargp;
+  cache_node_t *old = task->node, *node = NULL;
+  char key[MAXLINE], host[MAXLINE], port[MAXLINE], path[MAXLINE], req[MAXBUF];
+  char hdrs[HDR_RULE_EXTRA_MAX + 1];
+  timeout_t transfer_to;
+  int rc;
+
+  // 정규화된 캐시 키 자체가 원 서버 URI이므로 다시 파싱해서 요청 (알릴 클라이언트가 없으므로 connfd는 -1)
+  //    클라이언트 헤더 없이 원 서버의 요청 헤더 규칙이 붙이는 줄만 보냄
+  strcpy(key, old->uri);
+  if (parse_uri(key, host, port, path) == 0) {
+    upstream_t up = {.host = host, .port = port, .http10 = neg_lookup(host, port) == NEG_HTTP10};
+    hdrs[hdr_rule_append(hdr_rules_lookup(HDR_REQUEST, host, strlen(host)), 0, hdrs)] = '\0';
+    do {
+      build_request(req, "GET", path, host, hdrs, NULL, up.http10);
+      if (open_upstream(-1, &up, req, NULL, NULL) < 0) break;
+      timeout_start(&transfer_to, TO_TRANSFER, config.timeout_transfer * 1000, up.fd, -1);
+      node = fetch_into_cache(&up, old->uri, old, &rc);  // 성공 시 insert_cache가 기존 노드를 원자적으로 교체
+      if (timeout_cancel(&transfer_to)) rc = UP_CLOSE;
+    } while (finish_upstream(&up, rc));
+  }
+
+  if (node == NULL || node == old) {
+    __atomic_store_n(&old->refreshing, 0, __ATOMIC_RELEASE);  // 갱신 실패: 만료된 노드 유지
+  }
+  if (node) {
+    release_cache(node);
+  }
+  release_cache(old);
+  free(task);
+}
+
+// 서문 24바이트와 앞에서부터 비교 (HTTP/1.x 요청은 첫 바이트부터 달라지므로 더 읽지 않고 0)
+int is_h2_preface(rio_t *rp) {
+  char *buf = rp->rio_bufptr;
+  size_t avail = rp->rio_cnt > 0 ? rp->rio_cnt : 0;
+
+  while (1) {
+    size_t n = avail < H2_PREFACE_LEN ? avail : H2_PREFACE_LEN;
+    if (memcmp(buf, H2_PREFACE, n) != 0) return 0;
+    if (n == H2_PREFACE_LEN) return 1;
+    if (rio_peekmore(rp, &buf, &avail) <= 0) return 0;
+  }
+}
+
+static void put32(unsigned char *p, uint32_t v) {
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static uint32_t get32(const unsigned char *p) {
+  return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// 송신 큐에 프레임 하나 추가 (소켓에는 h2_flush가 씀)
+static void h2_queue(h2_conn_t *c, int type, int flags, uint32_t stream, const void *payload, size_t len) {
+  unsigned char hdr[H2_FRAME_HEADER];
+  h2_frame_write(hdr, len, type, flags, stream);
+  if (rio_outqueue(&c->out, hdr, H2_FRAME_HEADER) < 0 || (len > 0 && rio_outqueue(&c->out, payload, len) < 0)) {
+    c->out_err = 1;
+  }
+}
+
+// 페이로드가 32비트 값 하나인 프레임 (RST_STREAM, WINDOW_UPDATE)
+static void h2_queue32(h2_conn_t *c, int type, uint32_t stream, uint32_t v) {
+  unsigned char b[4];
+  put32(b, v);
+  h2_queue(c, type, 0, stream, b, 4);
+}
+
+// 연결 에러: GOAWAY를 보내고 연결을 닫음 (호출자는 -1을 그대로 돌려줌)
+static int h2_goaway(h2_conn_t *c, int code) {
+  unsigned char b[8];
+  put32(b, c->last_id);
+  put32(b + 4, code);
+  h2_queue(c, H2_GOAWAY, 0, 0, b, 8);
+  return -1;
+}
+
+static h2_stream_t *h2_find(h2_conn_t *c, uint32_t id) {
+  for (int i = 0; i < PIPELINE_MAX; i++) {
+    if (c->s[i].id == id) return &c->s[i];
+  }
+  return NULL;
+}
+
+// 받은 DATA를 처리 스레드 쪽 파이프로 넘겼거나 버림: 그만큼 연결 윈도를 돌려주고, s가 있으면 스트림 윈도도
+//    (요청이 끝난 스트림에는 더 받을 것이 없으므로 돌려주지 않음)
+static void h2_recv_credit(h2_conn_t *c, h2_stream_t *s, uint32_t n) {
+  if (n == 0) return;
+  c->recv_window += n;
+  h2_queue32(c, H2_WINDOW_UPDATE, 0, n);
+  if (s && !s->in_end) {
+    s->recv_window += n;
+    h2_queue32(c, H2_WINDOW_UPDATE, s->id, n);
+  }
+}
+
+// 스트림 정리 (code가 0 이상이면 RST_STREAM을 보냄). 처리 스레드는 닫힌 파이프에 쓰다 EPIPE로 끝남
+//    넘기지 못하고 버리는 요청 바디만큼 연결 윈도를 돌려줌
+static void h2_close_stream(h2_conn_t *c, h2_stream_t *s, int code) {
+  if (code >= 0) h2_queue32(c, H2_RST_STREAM, s->id, code);
+  h2_recv_credit(c, NULL, s->in_unacked);
+  if (s->p->fd[0] >= 0) close(s->p->fd[0]);
+  if (s->body_fd >= 0) close(s->body_fd);
+  release_pipelined(s->p);
+  free(s->in);
+  free(s->buf);
+  memset(s, 0, sizeof(*s));
+  c->nstreams--;
+}
+
+// hpack_decode 콜백: 헤더를 "이름\0값\0"으로 모음
+//    목록이 H2_HEADER_LIST를 넘어도 동적 테이블을 맞추기 위해 디코딩은 끝까지 하고 크기만 기록 (요청은 431)
+static int h2_collect(void *arg, const char *name, size_t nlen, const char *value, size_t vlen) {
+  h2_fields_t *f = arg;
+
+  f->size += nlen + vlen + 32;
+  if (f->size > H2_HEADER_LIST) return 0;
+  for (size_t k = 0; k < nlen; k++) {
+    if (isupper((unsigned char)name[k]) || (unsigned char)name[k] <= ' ' || name[k] == 0x7f) f->bad = 1;
+  }
+  if (nlen == 0 || memchr(value, '\0', vlen) || memchr(value, '\r', vlen) || memchr(value, '\n', vlen)) {
+    f->bad = 1;
+  }
+  if (f->len + nlen + vlen + 2 > f->cap) {
+    f->cap = (f->len + nlen + vlen + 2) * 2;
+    f->buf = Realloc(f->buf, f->cap);
+  }
+  memcpy(f->buf + f->len, name, nlen);
+  f->buf[f->len + nlen] = '\0';
+  memcpy(f->buf + f->len + nlen + 1, value, vlen);
+  f->buf[f->len + nlen + 1 + vlen] = '\0';
+  f->len += nlen + vlen + 2;
+  return 0;
+}
+
+// 디코딩한 헤더 목록을 HTTP/1.1 요청으로 바꿈 (read_client_request와 같은 정리 + 요청 헤더 규칙)
+//    :authority(없으면 host)와 :path로 절대 URI를 만들고, 나뉘어 온 cookie는 한 줄로 합침 (RFC 9113 8.2.3)
+//    연결 관련 헤더가 있거나 가상 헤더가 빠지면 형식 오류 (8.2.2, 8.3.1). CONNECT 터널은 지원하지 않음
+//    END_STREAM 없이 Content-Length도 없으면 DATA 프레임을 chunked로 감싸 원 서버에 넘김
+static void h2_request(const h2_fields_t *f, client_req_t *creq, int end_stream) {
+  const char *method = NULL, *path = NULL, *authority = NULL, *host = NULL, *p, *name, *value;
+  int regular = 0, has_length = 0, cookies = 0, bad = f->bad;
+  long length = 0;
+
+  creq->method[0] = creq->uri[0] = creq->range[0] = '\0';
+  creq->hdrs = NULL;
+  creq->body_len = end_stream ? 0 : -1;
+  creq->expect_continue = 0;
+  creq->tunnel = 0;
+  creq->keep_alive = 1;
+  creq->chunked_ok = 0;  // 응답 바디는 DATA 프레임이 나눔
+  creq->gzip_ok = 0;
+  creq->status = 0;
+  if (f->size > H2_HEADER_LIST) {
+    creq->status = 431;
+    return;
+  }
+
+  // 1. 가상 헤더 (일반 헤더보다 앞에만 올 수 있음)
+  for (p = f->buf; p < f->buf + f->len; p = value + strlen(value) + 1) {
+    name = p;
+    value = p + strlen(p) + 1;
+    if (name[0] != ':') {
+      regular = 1;
+      if (strcmp(name, "host") == 0) host = value;
+      continue;
+    }
+    if (regular) bad = 1;
+    if (strcmp(name, ":method") == 0) {
+      method = value;
+    } else if (strcmp(name, ":path") == 0) {
+      path = value;
+    } else if (strcmp(name, ":authority") == 0) {
+      authority = value;
+    } else if (strcmp(name, ":scheme") != 0) {
+      bad = 1;
+    }
+  }
+  if (authority == NULL) authority = host;
+  if (bad || method == NULL || path == NULL || path[0] != '/' || authority == NULL || authority[0] == '\0') {
+    creq->status = 400;
+    return;
+  }
+  if (strlen(method) >= sizeof(creq->method) || strcmp(method, "CONNECT") == 0) {
+    creq->status = 501;
+    return;
+  }
+  strcpy(creq->method, method);
+  if ((size_t)snprintf(creq->uri, sizeof(creq->uri), "http://%s%s", authority, path) >= sizeof(creq->uri)) {
+    creq->status = 414;
+    return;
+  }
+
+  // 2. 일반 헤더: "이름: 값\r\n"으로 다시 씀 (이름은 소문자 그대로, 줄마다 2바이트 늘어남)
+  size_t hdrs_len = 0, host_len = 0;
+  const char *origin = uri_host(creq->uri, &host_len);
+  const hdr_table_t *rules = hdr_rules_lookup(HDR_REQUEST, origin, host_len);
+  uint64_t seen = 0;
+  char *hdrs = Malloc(f->len + hdr_rule_extra(rules) + 64);
+  for (p = f->buf; p < f->buf + f->len; p = value + strlen(value) + 1) {
+    name = p;
+    value = p + strlen(p) + 1;
+    if (name[0] == ':') continue;
+    size_t nlen = strlen(name), vlen = strlen(value);
+    int id = http_header_id(name, nlen);
+    switch (id) {
+    case HTTP_H_CONNECTION:
+    case HTTP_H_PROXY_CONNECTION:
+    case HTTP_H_KEEP_ALIVE:
+    case HTTP_H_TRANSFER_ENCODING:
+    case HTTP_H_UPGRADE:
+      bad = 1;
+      continue;
+    case HTTP_H_TE:  // "trailers"만 허용되며 원 서버 연결과는 관계없음
+    case HTTP_H_HOST:
+    case HTTP_H_EXPECT:
+    case HTTP_H_PROXY_AUTHORIZATION:
+      continue;
+    case HTTP_H_RANGE:
+      snprintf(creq->range, sizeof(creq->range), "Range: %s\r\n", value);
+      continue;
+    case HTTP_H_CONTENT_LENGTH: {
+      long len = 0;
+      size_t k = 0;
+      while (k < vlen && k < 18 && isdigit((unsigned char)value[k])) len = len * 10 + (value[k++] - '0');
+      if (k == 0 || k < vlen || (has_length && len != length)) bad = 1;
+      length = len;
+      has_length = 1;
+      break;
+    }
+    case HTTP_H_ACCEPT_ENCODING:
+      creq->gzip_ok = config.gzip && accepts_gzip(value, vlen);
+      break;
+    }
+    if (nlen == 6 && strcmp(name, "cookie") == 0) {
+      cookies++;
+      continue;
+    }
+    if (!hdr_rule_keep(rules, id, name, nlen, &seen)) continue;
+    hdrs_len += sprintf(hdrs + hdrs_len, "%s: %s\r\n", name, value);
+  }
+  if (cookies > 0 && hdr_rule_keep(rules, HTTP_H_OTHER, "cookie", 6, &seen)) {
+    hdrs_len += sprintf(hdrs + hdrs_len, "cookie: ");
+    for (p = f->buf; p < f->buf + f->len; p = value + strlen(value) + 1) {
+      name = p;
+      value = p + strlen(p) + 1;
+      if (strcmp(name, "cookie") == 0) hdrs_len += sprintf(hdrs + hdrs_len, "%s; ", value);
+    }
+    hdrs_len -= 2;
+    hdrs_len += sprintf(hdrs + hdrs_len, "\r\n");
+  }
+  if (has_length) {
+    if (end_stream && length != 0) bad = 1;
+    creq->body_len = length;
+  } else if (creq->body_len < 0) {
+    hdrs_len += sprintf(hdrs + hdrs_len, "Transfer-Encoding: chunked\r\n");
+  }
+  hdrs_len += hdr_rule_append(rules, seen, hdrs + hdrs_len);
+  hdrs[hdrs_len] = '\0';
+  if (bad) {
+    free(hdrs);
+    creq->status = 400;
+    return;
+  }
+  creq->hdrs = hdrs;
+}
+
+// 요청 하나로 스트림을 열어 캐시나 처리 스레드에 맡김 (자리가 없거나 실패하면 REFUSED_STREAM: 클라이언트가 재시도)
+static void h2_open_stream(h2_conn_t *c, uint32_t id, client_req_t *creq, int end_stream) {
+  static __thread char head[MAXBUF + MAXLINE];
+  int body[2] = {-1, -1};
+  h2_stream_t *s = h2_find(c, 0);
+
+  if (creq->status == 0 && creq->body_len != 0 && pipe(body) < 0) {
+    free(creq->hdrs);
+    h2_queue32(c, H2_RST_STREAM, id, H2_REFUSED_STREAM);
+    return;
+  }
+  // 처리 스레드가 모두 바쁠 때 이벤트 루프에서 직접 처리하면 다른 스트림이 멈추므로 거절
+  pipelined_t *p = pipeline_dispatch(creq, body[0]);
+  if (p == NULL) {
+    if (errno == EBUSY) __atomic_add_fetch(&pipeline_inline, 1, __ATOMIC_RELAXED);
+    free(creq->hdrs);
+    if (body[0] >= 0) {
+      close(body[0]);
+      close(body[1]);
+    }
+    h2_queue32(c, H2_RST_STREAM, id, H2_REFUSED_STREAM);
+    return;
+  }
+  s->id = id;
+  s->p = p;
+  s->body_fd = body[1];
+  s->chunked = creq->body_len < 0;
+  s->in_end = end_stream;
+  s->buf = Malloc(H2_STREAM_BUF);
+  s->window = c->init_window;
+  s->recv_window = H2_WINDOW;  // SETTINGS_INITIAL_WINDOW_SIZE를 보내지 않으므로 기본값
+  if (s->body_fd >= 0) fcntl(s->body_fd, F_SETFL, O_NONBLOCK);
+  c->nstreams++;
+  __atomic_add_fetch(&h2_streams, 1, __ATOMIC_RELAXED);
+
+  if (p->node) {  // 신선한 캐시 적중: 응답 헤더만 buf에 만들고 바디는 노드에서 바로 보냄
+    long first, last;
+    int head_size;
+    resp_state.keep_alive = 1;
+    resp_state.close = 0;
+    if (!cached_head(p->node, p->req.range, head, sizeof(head), &head_size, &first, &last)) {
+      memcpy(s->buf, p->node->hdr, p->node->hdr_size);
+      s->len = p->node->hdr_size;
+    }
+    if (s->len + head_size > H2_STREAM_BUF) head_size = 0;  // 헤더가 끝나지 않으므로 아래에서 스트림 에러
+    memcpy(s->buf + s->len, head, head_size);
+    s->len += head_size;
+    s->eof = 1;
+    s->data = p->node->data + first;
+    s->dlen = last - first + 1;
+  } else {
+    fcntl(p->fd[0], F_SETFL, O_NONBLOCK);
+  }
+}
+
+// 요청 바디를 스트림의 입력 버퍼에 붙임 (chunked면 크기 줄과 CRLF로 감쌈)
+static void h2_body_append(h2_stream_t *s, const unsigned char *data, size_t len, int end) {
+  size_t need = s->in_len + len + 32;
+  if (need > s->in_cap) {
+    s->in_cap = need * 2;
+    s->in = Realloc(s->in, s->in_cap);
+  }
+  if (len > 0) {
+    if (s->chunked) s->in_len += sprintf(s->in + s->in_len, "%zx\r\n", len);
+    memcpy(s->in + s->in_len, data, len);
+    s->in_len += len;
+    if (s->chunked) s->in_len += sprintf(s->in + s->in_len, "\r\n");
+  }
+  if (end && s->chunked) s->in_len += sprintf(s->in + s->in_len, "0\r\n\r\n");
+}
+
+// 헤더 블록이 끝남: 디코딩해서 새 요청을 열거나 (이미 있는 스트림이면) trailer로 보고 버림
+static int h2_headers(h2_conn_t *c) {
+  h2_fields_t f = {0};
+  client_req_t creq;
+  uint32_t id = c->block_stream;
+  int end_stream = c->block_flags & H2_FLAG_END_STREAM;
+
+  c->block_stream = 0;
+  int rc = hpack_decode(&c->hpack, c->block, c->block_len, h2_collect, &f);  // 버리는 블록도 테이블은 갱신
+  c->block_len = 0;
+  if (rc != 0) {
+    free(f.buf);
+    return h2_goaway(c, H2_COMPRESSION_ERROR);
+  }
+  if (id <= c->last_id) {  // 요청 trailer: 원 서버에는 전하지 않고 바디의 끝으로만 씀
+    h2_stream_t *s = h2_find(c, id);
+    free(f.buf);
+    if (!end_stream) return h2_goaway(c, H2_PROTOCOL_ERROR);
+    if (s && !s->in_end) {
+      s->in_end = 1;
+      if (s->body_fd >= 0) h2_body_append(s, NULL, 0, 1);
+    }
+    return 0;
+  }
+  c->last_id = id;
+  if (c->goaway || c->nstreams >= config.pipeline_depth) {
+    free(f.buf);
+    h2_queue32(c, H2_RST_STREAM, id, H2_REFUSED_STREAM);
+    return 0;
+  }
+  h2_request(&f, &creq, end_stream);
+  free(f.buf);
+  h2_open_stream(c, id, &creq, end_stream);
+  return 0;
+}
+
+// 받은 프레임 하나 처리 (연결 에러면 GOAWAY를 넣고 -1)
+static int h2_frame(h2_conn_t *c, const h2_frame_t *f, const unsigned char *pl) {
+  h2_stream_t *s;
+  size_t off = 0, len = f->len;
+
+  if (c->block_stream && (f->type != H2_CONTINUATION || f->stream != c->block_stream)) {
+    return h2_goaway(c, H2_PROTOCOL_ERROR);  // 헤더 블록 사이에는 다른 프레임이 올 수 없음
+  }
+  switch (f->type) {
+  case H2_DATA:
+    if (f->stream == 0) return h2_goaway(c, H2_PROTOCOL_ERROR);
+    if (f->flags & H2_FLAG_PADDED) {
+      if (len < 1 || pl[0] >= len) return h2_goaway(c, H2_PROTOCOL_ERROR);
+      off = 1;
+      len -= 1 + pl[0];
+    }
+    // 흐름 제어: 패딩을 포함한 페이로드가 알려 준 윈도를 넘으면 에러 (넘은 페이로드는 버퍼에 넣지 않음)
+    //    윈도는 바디가 파이프로 넘어가거나 버려질 때 돌려주므로 스트림마다 버퍼는 윈도 크기를 넘지 않음
+    if (f->len > c->recv_window) return h2_goaway(c, H2_FLOW_CONTROL_ERROR);
+    c->recv_window -= f->len;
+    if ((s = h2_find(c, f->stream)) == NULL) {
+      if (f->stream > c->last_id) return h2_goaway(c, H2_PROTOCOL_ERROR);
+      h2_recv_credit(c, NULL, f->len);  // 닫은 스트림이면 버림
+      return 0;
+    }
+    if (s->in_end || f->len > s->recv_window) {
+      h2_recv_credit(c, NULL, f->len);
+      h2_close_stream(c, s, s->in_end ? H2_STREAM_CLOSED : H2_FLOW_CONTROL_ERROR);
+      return 0;
+    }
+    s->recv_window -= f->len;
+    s->in_end = f->flags & H2_FLAG_END_STREAM;
+    if (s->body_fd >= 0) {
+      h2_body_append(s, pl + off, len, s->in_end);
+      s->in_unacked += f->len;
+    } else {
+      h2_recv_credit(c, NULL, f->len);  // 바디를 더 넘길 곳이 없음: 버림
+    }
+    return 0;
+
+  case H2_HEADERS:
+    if (f->stream == 0 || (f->stream & 1) == 0) return h2_goaway(c, H2_PROTOCOL_ERROR);
+    if (f->flags & H2_FLAG_PADDED) {
+      if (len < 1) return h2_goaway(c, H2_PROTOCOL_ERROR);
+      off = 1;
+      len -= pl[0];
+    }
+    if (f->flags & H2_FLAG_PRIORITY) off += 5;
+    if (off > len || len > f->len) return h2_goaway(c, H2_PROTOCOL_ERROR);
+    if (f->stream < c->last_id && h2_find(c, f->stream) == NULL) return h2_goaway(c, H2_STREAM_CLOSED);
+    c->block_stream = f->stream;
+    c->block_flags = f->flags;
+    c->block_len = 0;
+    /* fall through */
+  case H2_CONTINUATION:
+    if (c->block_stream == 0) return h2_goaway(c, H2_PROTOCOL_ERROR);
+    if (c->block_len + len - off > H2_HEADER_LIST) return h2_goaway(c, H2_ENHANCE_YOUR_CALM);
+    memcpy(c->block + c->block_len, pl + off, len - off);
+    c->block_len += len - off;
+    return f->flags & H2_FLAG_END_HEADERS ? h2_headers(c) : 0;
+
+  case H2_SETTINGS:
+    if (f->stream != 0) return h2_goaway(c, H2_PROTOCOL_ERROR);
+    if (f->flags & H2_FLAG_ACK) return f->len == 0 ? 0 : h2_goaway(c, H2_FRAME_SIZE_ERROR);
+    if (f->len % 6) return h2_goaway(c, H2_FRAME_SIZE_ERROR);
+    for (off = 0; off < f->len; off += 6) {
+      int id = pl[off] << 8 | pl[off + 1];
+      uint32_t v = get32(pl + off + 2);
+      if (id == H2_SET_INITIAL_WINDOW_SIZE) {
+        if (v > 0x7fffffff) return h2_goaway(c, H2_FLOW_CONTROL_ERROR);
+        for (int i = 0; i < PIPELINE_MAX; i++) {
+          if (c->s[i].id) c->s[i].window += (long)v - c->init_window;
+        }
+        c->init_window = v;
+      } else if (id == H2_SET_MAX_FRAME_SIZE && (v < H2_MAX_FRAME || v > 0xffffff)) {
+        return h2_goaway(c, H2_PROTOCOL_ERROR);
+      } else if (id == H2_SET_ENABLE_PUSH && v > 1) {
+        return h2_goaway(c, H2_PROTOCOL_ERROR);
+      }
+    }
+    h2_queue(c, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+    return 0;
+
+  case H2_PING:
+    if (f->stream != 0) return h2_goaway(c, H2_PROTOCOL_ERROR);
+    if (f->len != 8) return h2_goaway(c, H2_FRAME_SIZE_ERROR);
+    if (!(f->flags & H2_FLAG_ACK)) h2_queue(c, H2_PING, H2_FLAG_ACK, 0, pl, 8);
+    return 0;
+
+  case H2_WINDOW_UPDATE: {
+    if (f->len != 4) return h2_goaway(c, H2_FRAME_SIZE_ERROR);
+    long inc = get32(pl) & 0x7fffffff;
+    if (f->stream == 0) {
+      if (inc == 0) return h2_goaway(c, H2_PROTOCOL_ERROR);
+      if ((c->window += inc) > 0x7fffffff) return h2_goaway(c, H2_FLOW_CONTROL_ERROR);
+    } else if ((s = h2_find(c, f->stream)) != NULL) {
+      if (inc == 0) {
+        h2_close_stream(c, s, H2_PROTOCOL_ERROR);
+      } else if ((s->window += inc) > 0x7fffffff) {
+        h2_close_stream(c, s, H2_FLOW_CONTROL_ERROR);
+      }
+    }
+    return 0;
+  }
+
+  case H2_RST_STREAM:
+    if (f->stream == 0) return h2_goaway(c, H2_PROTOCOL_ERROR);
+    if (f->len != 4) return h2_goaway(c, H2_FRAME_SIZE_ERROR);
+    if ((s = h2_find(c, f->stream)) != NULL) h2_close_stream(c, s, -1);
+    return 0;
+
+  case H2_GOAWAY:
+    if (f->stream != 0) return h2_goaway(c, H2_PROTOCOL_ERROR);
+    if (f->len < 8) return h2_goaway(c, H2_FRAME_SIZE_ERROR);  // 마지막 스트림 ID + 에러 코드 (뒤는 디버그 데이터)
+    c->goaway = 1;  // 이미 연 스트림은 마저 응답
+    return 0;
+
+  case H2_PUSH_PROMISE:  // 클라이언트는 보낼 수 없음
+    return h2_goaway(c, H2_PROTOCOL_ERROR);
+  }
+  return 0;  // PRIORITY와 모르는 프레임은 무시
+}
+
+// 처리 스레드나 캐시가 만든 HTTP/1.x 응답 헤더를 HEADERS(+CONTINUATION) 프레임으로 바꿈
+//    상태 줄은 :status로, 헤더 이름은 소문자로 바꾸고 연결 관련 헤더는 버림 (RFC 9113 8.2.2)
+//    헤더가 아직 다 오지 않았으면 0, 버퍼를 넘거나 형식이 다르면 -1
+static int h2_response_head(h2_conn_t *c, h2_stream_t *s) {
+  size_t hlen = 4, n, off = 0;
+
+  while (hlen <= s->len && memcmp(s->buf + hlen - 4, "\r\n\r\n", 4) != 0) hlen++;
+  if (hlen > s->len) return s->eof || s->len == H2_STREAM_BUF ? -1 : 0;
+  if (hlen < 16 || strncmp(s->buf, "HTTP/1.", 7) != 0) return -1;
+
+  // 줄마다 인코딩 결과는 원래 줄보다 최대 9바이트 길고, 줄은 3바이트 이상 ("x:\r\n")
+  unsigned char *block = Malloc(hlen * 4 + 16);
+  n = hpack_encode_status(block, atoi(s->buf + 9));
+  char *line = memchr(s->buf, '\n', hlen) + 1, *end = s->buf + hlen - 2;
+  while (line < end) {
+    char *name = line, *next = memchr(line, '\n', end + 2 - line) + 1;
+    size_t len = next - line - 2, nlen = http_name_len(line, len);
+    line = next;
+    if (nlen == len) continue;
+    switch (http_header_id(name, nlen)) {
+    case HTTP_H_CONNECTION:
+    case HTTP_H_PROXY_CONNECTION:
+    case HTTP_H_KEEP_ALIVE:
+    case HTTP_H_TRANSFER_ENCODING:
+    case HTTP_H_UPGRADE:
+    case HTTP_H_TE:
+      continue;
+    }
+    char *value = name + nlen + 1, *vend = name + len;
+    while (value < vend && (*value == ' ' || *value == '\t')) value++;
+    while (vend > value && (vend[-1] == ' ' || vend[-1] == '\t')) vend--;
+    for (size_t k = 0; k < nlen; k++) name[k] = tolower((unsigned char)name[k]);
+    n += hpack_encode(block + n, name, nlen, value, vend - value);
+  }
+  do {  // 블록이 한 프레임에 들어가지 않으면 CONTINUATION으로 나눔
+    size_t chunk = n - off < H2_MAX_FRAME ? n - off : H2_MAX_FRAME;
+    h2_queue(c, off == 0 ? H2_HEADERS : H2_CONTINUATION, off + chunk == n ? H2_FLAG_END_HEADERS : 0,
+             s->id, block + off, chunk);
+    off += chunk;
+  } while (off < n);
+  free(block);
+
+  s->headers_sent = 1;
+  if (s->p->node == NULL) {  // 헤더 뒤에 같이 읽은 바디
+    s->data = s->buf + hlen;
+    s->dlen = s->len - hlen;
+  }
+  return 1;
+}
+
+// 모아 둔 요청 바디를 파이프에 씀. 다 넘기면 받은 만큼 스트림 윈도를 돌려주고, 요청이 끝났으면 파이프를 닫음
+static void h2_body_flush(h2_conn_t *c, h2_stream_t *s) {
+  if (s->in_len > 0) {
+    ssize_t n = write(s->body_fd, s->in, s->in_len);
+    if (n < 0 && errno != EAGAIN && errno != EINTR) {  // 처리 스레드가 바디를 더 읽지 않음 (이미 응답함)
+      close(s->body_fd);
+      s->body_fd = -1;
+      s->in_len = 0;
+      h2_recv_credit(c, NULL, s->in_unacked);
+      s->in_unacked = 0;
+      return;
+    }
+    if (n > 0) {
+      memmove(s->in, s->in + n, s->in_len - n);
+      s->in_len -= n;
+    }
+  }
+  if (s->in_len == 0) {
+    h2_recv_credit(c, s, s->in_unacked);
+    s->in_unacked = 0;
+    if (s->in_end) {
+      close(s->body_fd);
+      s->body_fd = -1;
+    }
+  }
+}
+
+// 응답을 다 보냄: 클라이언트가 아직 요청 바디를 보내는 중이면 RST_STREAM(NO_ERROR)으로 그만 보내게 함
+static void h2_finish(h2_conn_t *c, h2_stream_t *s) {
+  h2_close_stream(c, s, s->in_end ? -1 : H2_NO_ERROR);
+}
+
+// 스트림마다 파이프에서 응답을 읽어 프레임으로 만듦
+//    DATA는 스트림을 돌아가며 한 프레임씩 만들어 큰 응답이 작은 응답을 막지 않게 하고,
+//    송신 버퍼가 H2_OUT_HIGH만큼 차면 멈춰 느린 클라이언트 때문에 버퍼가 커지지 않게 함
+static void h2_pump(h2_conn_t *c) {
+  int progress = 1;
+
+  while (progress && rio_outpending(&c->out) < H2_OUT_HIGH) {
+    progress = 0;
+    for (int i = 0; i < PIPELINE_MAX && rio_outpending(&c->out) < H2_OUT_HIGH; i++) {
+      h2_stream_t *s = &c->s[i];
+      if (s->id == 0) continue;
+
+      // 1. 보낼 바디가 없으면 파이프에서 더 읽음 (스트림 윈도가 닫혀 있으면 읽지 않고 기다림)
+      if (!s->eof && s->dlen == 0 && (!s->headers_sent || s->window > 0)) {
+        if (s->headers_sent) s->len = 0;
+        ssize_t n = s->len < H2_STREAM_BUF ? read(s->p->fd[0], s->buf + s->len, H2_STREAM_BUF - s->len) : -1;
+        if (n > 0) {
+          if (s->headers_sent) {
+            s->data = s->buf;
+            s->dlen = n;
+          }
+          s->len += n;
+          progress = 1;
+        } else if (n == 0) {
+          s->eof = 1;
+          progress = 1;
+        } else if (s->len < H2_STREAM_BUF && errno != EAGAIN && errno != EINTR) {
+          h2_close_stream(c, s, H2_INTERNAL_ERROR);
+          continue;
+        }
+      }
+
+      // 2. 응답 헤더
+      if (!s->headers_sent) {
+        int rc = h2_response_head(c, s);
+        if (rc < 0) {
+          h2_close_stream(c, s, H2_INTERNAL_ERROR);
+          continue;
+        }
+        if (rc == 0) continue;
+        progress = 1;
+      }
+
+      // 3. DATA 한 프레임 (스트림과 연결의 송신 윈도 안에서). 응답이 끝났으면 END_STREAM
+      if (s->dlen > 0 && s->window > 0 && c->window > 0) {
+        size_t n = s->dlen;
+        if ((long)n > s->window) n = s->window;
+        if ((long)n > c->window) n = c->window;
+        if (n > H2_MAX_FRAME) n = H2_MAX_FRAME;
+        int end = s->eof && n == s->dlen;
+        h2_queue(c, H2_DATA, end ? H2_FLAG_END_STREAM : 0, s->id, s->data, n);
+        s->data += n;
+        s->dlen -= n;
+        s->window -= n;
+        c->window -= n;
+        progress = 1;
+        if (end) h2_finish(c, s);
+      } else if (s->eof && s->dlen == 0) {
+        h2_queue(c, H2_DATA, H2_FLAG_END_STREAM, s->id, NULL, 0);
+        h2_finish(c, s);
+        progress = 1;
+      }
+    }
+  }
+}
+
+// 송신 큐를 소켓이 받는 만큼 씀 (쓰기 에러나 큐에 넣지 못한 프레임이 있으면 -1)
+static int h2_flush(h2_conn_t *c) {
+  return rio_flush_nb(&c->out) < 0 || c->out_err ? -1 : 0;
+}
+
+// 연결 스레드 혼자 모든 스트림을 다루는 이벤트 루프
+//    요청은 HTTP/1.1 파이프라이닝과 같은 경로(pipeline_dispatch)로 캐시 노드나 처리 스레드에 맡기고,
+//    처리 스레드가 파이프에 쓴 HTTP/1.x 응답을 HEADERS와 DATA 프레임으로 바꿔 끝나는 순서대로 섞어 보냄
+//    동시 스트림 수는 pipeline_depth, 스트림이 없을 때는 keep-alive 제한 시간이 지나면 GOAWAY 후 닫음
+void h2_serve(int connfd, rio_t *rp) {
+  h2_conn_t *c = Calloc(1, sizeof(h2_conn_t));
+  struct pollfd pfd[1 + 2 * PIPELINE_MAX];
+  unsigned char set[12];
+  int timed_out = 0;
+
+  c->fd = connfd;
+  hpack_init(&c->hpack);
+  rio_outinit(&c->out, connfd);
+  c->block = Malloc(H2_HEADER_LIST);
+  c->window = c->init_window = H2_WINDOW;
+  c->recv_window = H2_WINDOW;
+  __atomic_add_fetch(&h2_conns, 1, __ATOMIC_RELAXED);
+
+  // 서문 뒤에 이미 읽어 둔 바이트는 프레임 버퍼로 옮기고 이후로는 소켓을 직접 읽음
+  rio_consumeb(rp, H2_PREFACE_LEN);
+  c->in_len = rp->rio_cnt > 0 ? rp->rio_cnt : 0;
+  memcpy(c->in, rp->rio_bufptr, c->in_len);
+  fcntl(connfd, F_SETFL, fcntl(connfd, F_GETFL) | O_NONBLOCK);
+
+  set[0] = 0;
+  set[1] = H2_SET_MAX_CONCURRENT_STREAMS;
+  put32(set + 2, config.pipeline_depth);
+  set[6] = 0;
+  set[7] = H2_SET_MAX_HEADER_LIST_SIZE;
+  put32(set + 8, H2_HEADER_LIST);
+  h2_queue(c, H2_SETTINGS, 0, 0, set, 12);
+  // 연결 윈도를 동시 스트림 수만큼 키워, 처리 스레드가 늦게 읽는 스트림 하나가 연결 윈도를 다 차지하지 못하게 함
+  if (config.pipeline_depth > 1) {
+    h2_queue32(c, H2_WINDOW_UPDATE, 0, (uint32_t)(config.pipeline_depth - 1) * H2_WINDOW);
+    c->recv_window += (long)(config.pipeline_depth - 1) * H2_WINDOW;
+  }
+
+  while (1) {
+    // 1. 받은 프레임 처리 (마지막 프레임이 덜 왔으면 남겨 둠)
+    size_t off = 0;
+    int err = 0;
+    while (!err && c->in_len - off >= H2_FRAME_HEADER) {
+      h2_frame_t f;
+      h2_frame_read(c->in + off, &f);
+      if (f.len > H2_MAX_FRAME) {
+        err = h2_goaway(c, H2_FRAME_SIZE_ERROR);
+        break;
+      }
+      if (c->in_len - off < H2_FRAME_HEADER + f.len) break;
+      err = h2_frame(c, &f, c->in + off + H2_FRAME_HEADER);
+      off += H2_FRAME_HEADER + f.len;
+    }
+    memmove(c->in, c->in + off, c->in_len - off);
+    c->in_len -= off;
+    if (err) break;
+
+    // 2. 요청 바디를 처리 스레드에 넘기고 응답을 프레임으로 만들어 보냄
+    for (int i = 0; i < PIPELINE_MAX; i++) {
+      if (c->s[i].id && c->s[i].body_fd >= 0) h2_body_flush(c, &c->s[i]);
+    }
+    h2_pump(c);
+    if (h2_flush(c) < 0) break;
+    if (c->goaway && c->nstreams == 0 && rio_outpending(&c->out) == 0) break;
+
+    // 3. 클라이언트 소켓, 응답 파이프, 요청 바디 파이프 중 하나가 준비될 때까지 대기
+    //    응답을 만드는 중인 처리 스레드가 있으면 그 요청의 제한 시간에 맡기고 연결에는 제한 시간을 두지 않음
+    //    모든 스트림이 클라이언트(윈도, 송신 큐, 요청 바디)를 기다릴 때만 무응답 제한
+    int n = 1, working = 0;
+    pfd[0].fd = connfd;
+    size_t pending = rio_outpending(&c->out);
+    pfd[0].events = (pending < H2_OUT_HIGH ? POLLIN : 0) | (pending > 0 ? POLLOUT : 0);
+    for (int i = 0; i < PIPELINE_MAX; i++) {
+      h2_stream_t *s = &c->s[i];
+      if (s->id == 0) continue;
+      if (!s->eof && s->dlen == 0 && (!s->headers_sent || s->window > 0)) {
+        pfd[n].fd = s->p->fd[0];
+        pfd[n++].events = POLLIN;
+        if (s->body_fd < 0 || s->in_len > 0 || s->in_end) working = 1;
+      }
+      if (s->body_fd >= 0 && s->in_len > 0) {
+        pfd[n].fd = s->body_fd;
+        pfd[n++].events = POLLOUT;
+      }
+    }
+    int secs = c->nstreams > 0 ? (working && pending < H2_OUT_HIGH ? 0 : config.timeout_idle)
+             : c->last_id > 0 && config.keepalive_timeout > 0 ? config.keepalive_timeout : config.timeout_header;
+    int ready = poll(pfd, n, secs > 0 ? secs * 1000 : -1);
+    if (ready < 0 && errno == EINTR) continue;
+    if (ready == 0) {
+      timeout_count(c->nstreams > 0 ? TO_IDLE : c->last_id > 0 ? TO_KEEPALIVE : TO_HEADER);
+      timed_out = 1;
+    }
+    if (ready <= 0) break;
+    if (pfd[0].revents) {
+      ssize_t r = read(connfd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+      if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) break;  // 클라이언트가 끊음
+      if (r > 0) c->in_len += r;
+    }
+  }
+
+  if (timed_out) {  // 닫기 전에 GOAWAY로 알림 (남은 스트림은 클라이언트가 다른 연결로 재시도)
+    h2_goaway(c, H2_NO_ERROR);
+  }
+  h2_flush(c);  // GOAWAY 등 남은 프레임 (보낼 수 있는 만큼만)
+  for (int i = 0; i < PIPELINE_MAX; i++) {
+    if (c->s[i].id) h2_close_stream(c, &c->s[i], -1);
+  }
+  hpack_free(&c->hpack);
+  free(c->block);
+  rio_outfree(&c->out);
+  free(c);
+}
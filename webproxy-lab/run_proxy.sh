@@ -39,7 +39,7 @@ trap cleanup EXIT
 # ========== Proxy 빌드 ==========
 if [ proxy.c -nt proxy ] || [ csapp.c -nt proxy ]; then
   echo "🔧 Rebuilding Proxy server (source changed)..."
-  gcc -o proxy proxy.c csapp.c -lpthread
+  gcc -o proxy proxy.c csapp.c dnscache.c timeout.c httpparse.c hdrrules.c h2.c -lpthread -lz
 fi
 
 # ========== Proxy 실행 ==========
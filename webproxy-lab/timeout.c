@@ -0,0 +1,163 @@
+/*
+ * timeout.c - 단계별 제한 시간과 reaper 스레드 (timeout.h 참고)
+ */
+#include "timeout.h"
+
+static struct {
+  timeout_t **heap;       // 마감 시각(when) 기준 최소 힙
+  int n;                  // 힙에 들어 있는 타이머 수
+  int cap;                // 힙 배열 크기
+  pthread_mutex_t mutex;  // 힙과 통계 보호
+  pthread_cond_t changed; // 힙의 맨 앞이 바뀌었을 때 reaper를 깨움
+  unsigned long counts[TO_KINDS];
+} to;
+
+static const char *names[TO_KINDS] = {"connect", "header", "first_byte", "idle", "transfer", "keepalive"};
+
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static void heap_set(int i, timeout_t *t) {
+  to.heap[i] = t;
+  t->idx = i;
+}
+
+static void sift_up(int i) {
+  timeout_t *t = to.heap[i];
+  while (i > 0 && to.heap[(i - 1) / 2]->when > t->when) {
+    heap_set(i, to.heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  heap_set(i, t);
+}
+
+static void sift_down(int i) {
+  timeout_t *t = to.heap[i];
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= to.n) break;
+    if (c + 1 < to.n && to.heap[c + 1]->when < to.heap[c]->when) c++;
+    if (to.heap[c]->when >= t->when) break;
+    heap_set(i, to.heap[c]);
+    i = c;
+  }
+  heap_set(i, t);
+}
+
+static void heap_remove(timeout_t *t) {
+  int i = t->idx;
+  timeout_t *last = to.heap[--to.n];
+  t->idx = -1;
+  if (i == to.n) return;
+  heap_set(i, last);
+  sift_up(i);
+  sift_down(last->idx);
+}
+
+// 가장 이른 마감까지 기다렸다가 만료된 타이머의 소켓을 shutdown
+static void *reaper(void *vargp) {
+  pthread_detach(pthread_self());
+
+  pthread_mutex_lock(&to.mutex);
+  while (1) {
+    if (to.n == 0) {
+      pthread_cond_wait(&to.changed, &to.mutex);
+      continue;
+    }
+    timeout_t *t = to.heap[0];
+    long now = now_ms();
+    long deadline = __atomic_load_n(&t->deadline, __ATOMIC_RELAXED);
+    if (deadline > t->when) {  // 워커가 마감을 미뤘음: 새 마감으로 재배치
+      t->when = deadline;
+      sift_down(0);
+      continue;
+    }
+    if (t->when > now) {
+      struct timespec ts;
+      ts.tv_sec = t->when / 1000;
+      ts.tv_nsec = (t->when % 1000) * 1000000;
+      pthread_cond_timedwait(&to.changed, &to.mutex, &ts);
+      continue;
+    }
+
+    // 만료: 락을 잡은 채로 shutdown하므로 timeout_cancel 이후에는 소켓을 건드리지 않음
+    heap_remove(t);
+    t->fired = 1;
+    to.counts[t->kind]++;
+    for (int i = 0; i < 2; i++) {
+      if (t->fd[i] >= 0) shutdown(t->fd[i], SHUT_RDWR);
+    }
+  }
+  return NULL;
+}
+
+void timeout_init(void) {
+  pthread_condattr_t attr;
+  pthread_t tid;
+
+  to.cap = 64;
+  to.heap = Malloc(to.cap * sizeof(timeout_t *));
+  pthread_mutex_init(&to.mutex, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);  // now_ms와 같은 시계로 대기
+  pthread_cond_init(&to.changed, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_create(&tid, NULL, reaper, NULL);
+}
+
+void timeout_start(timeout_t *t, int kind, int ms, int fd1, int fd2) {
+  t->idx = -1;
+  t->fired = 0;
+  if (ms <= 0) return;  // 제한 없음
+
+  t->fd[0] = fd1;
+  t->fd[1] = fd2;
+  t->kind = kind;
+  t->when = t->deadline = now_ms() + ms;
+
+  pthread_mutex_lock(&to.mutex);
+  if (to.n == to.cap) {
+    to.cap *= 2;
+    to.heap = Realloc(to.heap, to.cap * sizeof(timeout_t *));
+  }
+  heap_set(to.n, t);
+  sift_up(to.n++);
+  if (t->idx == 0) {
+    pthread_cond_signal(&to.changed);  // 더 이른 마감: reaper가 다시 계산하도록 깨움
+  }
+  pthread_mutex_unlock(&to.mutex);
+}
+
+void timeout_extend(timeout_t *t, int ms) {
+  // 힙 키(when)는 그대로 두고 마감만 갱신: reaper가 꺼냈을 때 재배치하므로 매번 락을 잡지 않음
+  __atomic_store_n(&t->deadline, now_ms() + ms, __ATOMIC_RELAXED);
+}
+
+int timeout_cancel(timeout_t *t) {
+  pthread_mutex_lock(&to.mutex);
+  if (t->idx >= 0) {
+    heap_remove(t);
+  }
+  int fired = t->fired;
+  pthread_mutex_unlock(&to.mutex);
+  return fired;
+}
+
+void timeout_count(int kind) {
+  pthread_mutex_lock(&to.mutex);
+  to.counts[kind]++;
+  pthread_mutex_unlock(&to.mutex);
+}
+
+void timeout_stats(unsigned long counts[TO_KINDS]) {
+  pthread_mutex_lock(&to.mutex);
+  memcpy(counts, to.counts, sizeof(to.counts));
+  pthread_mutex_unlock(&to.mutex);
+}
+
+const char *timeout_name(int kind) {
+  return names[kind];
+}
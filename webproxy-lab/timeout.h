@@ -0,0 +1,41 @@
+/*
+ * timeout.h - 연결 단계별 제한 시간과 만료된 연결을 정리하는 reaper 스레드
+ *
+ * 워커는 블로킹 I/O를 하기 전에 타이머를 등록하고 끝나면 취소한다. 모든
+ * 타이머는 마감 시각 기준 최소 힙 하나에 모이고, reaper 스레드가 가장 이른
+ * 마감까지 잠들었다가 만료된 타이머의 소켓을 shutdown()한다. 그러면 그
+ * 소켓에서 막혀 있던 read/write가 바로 실패하므로 워커가 풀려난다.
+ */
+#ifndef __TIMEOUT_H__
+#define __TIMEOUT_H__
+
+#include "csapp.h"
+
+enum {
+  TO_CONNECT,       // 원 서버 연결 (open_clientfd_ai가 직접 처리, 여기서는 횟수만 셈)
+  TO_HEADER,        // 클라이언트 요청 헤더 읽기
+  TO_FIRST_BYTE,    // 요청을 보낸 뒤 원 서버 응답 헤더를 받을 때까지
+  TO_IDLE,          // 응답 바디를 받는 중 데이터 사이의 공백
+  TO_TRANSFER,      // 요청 하나의 전체 전송 시간
+  TO_KEEPALIVE,     // keep-alive 연결에서 다음 요청을 기다리는 시간
+  TO_KINDS
+};  // 제한 시간 종류
+
+typedef struct {
+  int fd[2];        // 만료 시 shutdown할 소켓 (-1이면 없음)
+  int kind;         // TO_* 종류
+  long when;        // 힙 정렬 키 (ms)
+  long deadline;    // 실제 마감 시각 (ms, timeout_extend로 늘어나면 when보다 커짐)
+  int idx;          // 힙 안의 위치 (-1이면 등록되지 않음)
+  int fired;        // 만료되어 소켓이 shutdown되었는지
+} timeout_t;  // 호출자 스택에 두는 타이머
+
+void timeout_init(void);  // 힙과 reaper 스레드 초기화
+void timeout_start(timeout_t *t, int kind, int ms, int fd1, int fd2);  // ms 후 fd1, fd2를 shutdown (ms <= 0이면 등록 안 함)
+void timeout_extend(timeout_t *t, int ms);  // 마감을 지금부터 ms 후로 미룸 (락 없이 호출 가능)
+int timeout_cancel(timeout_t *t);           // 타이머 해제, 이미 만료되었다면 1 반환
+void timeout_count(int kind);               // 다른 곳에서 감지한 만료 횟수 기록 (연결 제한 시간 등)
+void timeout_stats(unsigned long counts[TO_KINDS]);  // 종류별 만료 횟수 복사
+const char *timeout_name(int kind);         // 통계 출력용 이름
+
+#endif /* __TIMEOUT_H__ */
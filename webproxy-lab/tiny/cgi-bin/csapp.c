@@ -23,6 +23,9 @@
  */
 /* $begin csapp.c */
 #include "csapp.h"
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 /************************** 
  * Error-handling functions
@@ -792,6 +795,41 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - Robustly write a gather list (unbuffered). The iovec
+ *    array is advanced in place past whatever a short write consumed.
+ */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    size_t n = 0, nleft;
+    ssize_t nwritten;
+    int i;
+
+    for (i = 0; i < iovcnt; i++)
+	n += iov[i].iov_len;
+
+    nleft = n;
+    while (nleft > 0) {
+	if ((nwritten = writev(fd, iov, iovcnt)) <= 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		nwritten = 0;    /* and call writev() again */
+	    else
+		return -1;       /* errno set by writev() */
+	}
+	nleft -= nwritten;
+	while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len; /* Skip fully written entries */
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    return n;
+}
+
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -864,35 +902,400 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 }
 /* $end rio_readnb */
 
+/*
+ * rio_readsomeb - Read whatever is available, up to n bytes, blocking
+ *    only when nothing is buffered. With an empty internal buffer a
+ *    request of at least RIO_BUFSIZE bytes is read straight into usrbuf.
+ *    Returns the byte count, 0 on EOF, or -1 on error.
+ */
+ssize_t rio_readsomeb(rio_t *rp, void *usrbuf, size_t n)
+{
+    ssize_t rc;
+
+    if (rp->rio_cnt > 0 || n < sizeof(rp->rio_buf))
+	return rio_read(rp, usrbuf, n);
+    while ((rc = read(rp->rio_fd, usrbuf, n)) < 0)
+	if (errno != EINTR)
+	    return -1;
+    return rc;
+}
+
+/*
+ * rio_fill - Refill the internal buffer if it is empty. Returns the
+ *    number of unread bytes, 0 on EOF, or -1 on error.
+ */
+static ssize_t rio_fill(rio_t *rp)
+{
+    while (rp->rio_cnt <= 0) {  /* Refill if buf is empty */
+	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
+			   sizeof(rp->rio_buf));
+	if (rp->rio_cnt < 0) {
+	    if (errno != EINTR) /* Interrupted by sig handler return */
+		return -1;
+	}
+	else if (rp->rio_cnt == 0)  /* EOF */
+	    return 0;
+	else 
+	    rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
+    }
+    return rp->rio_cnt;
+}
+
+/*
+ * rio_findnl - Return a pointer to the first '\n' in p[0..n), or NULL.
+ *    Scans 32 (AVX2) or 16 (SSE2) bytes per step when the compiler
+ *    targets those instruction sets, and falls back to memchr.
+ */
+static char *rio_findnl(char *p, size_t n)
+{
+#ifdef __AVX2__
+    const __m256i nl32 = _mm256_set1_epi8('\n');
+    while (n >= 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl32));
+	if (mask)
+	    return p + __builtin_ctz(mask);
+	p += 32;
+	n -= 32;
+    }
+#endif
+#ifdef __SSE2__
+    const __m128i nl16 = _mm_set1_epi8('\n');
+    while (n >= 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl16));
+	if (mask)
+	    return p + __builtin_ctz(mask);
+	p += 16;
+	n -= 16;
+    }
+#endif
+    return memchr(p, '\n', n);
+}
+
 /* 
- * rio_readlineb - Robustly read a text line (buffered)
+ * rio_readlineb - Robustly read a text line (buffered). Scans the
+ *    internal buffer for the newline and copies whole runs at once
+ *    instead of going through rio_read one byte at a time.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
+    size_t n = 0, cnt;
+    ssize_t rc;
+    char *bufp = usrbuf, *nl = NULL;
 
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
+    while (!nl && n + 1 < maxlen) {
+	if ((rc = rio_fill(rp)) < 0)
+	    return -1;	  /* Error */
+	else if (rc == 0) {
+	    if (n == 0)
 		return 0; /* EOF, no data read */
 	    else
 		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+	}
+
+	/* Copy up to and including the newline, or as much as fits */
+	cnt = maxlen - 1 - n;
+	if ((size_t)rp->rio_cnt < cnt)
+	    cnt = rp->rio_cnt;
+	if ((nl = rio_findnl(rp->rio_bufptr, cnt)) != NULL)
+	    cnt = nl - rp->rio_bufptr + 1;
+	memcpy(bufp, rp->rio_bufptr, cnt);
+	bufp += cnt;
+	n += cnt;
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
     }
     *bufp = 0;
-    return n-1;
+    return n;
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_fillmore - Read more bytes into the internal buffer without
+ *    discarding unread ones. Unread bytes are moved to the front of
+ *    rio_buf first, so a partial line that straddles a refill stays
+ *    contiguous. Returns bytes added, 0 on EOF or a full buffer, -1 on
+ *    error.
+ */
+static ssize_t rio_fillmore(rio_t *rp)
+{
+    ssize_t nread;
+
+    if (rp->rio_cnt <= 0) {
+	rp->rio_cnt = 0;
+	rp->rio_bufptr = rp->rio_buf;
+    } else if (rp->rio_bufptr != rp->rio_buf) { /* Compact */
+	memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	rp->rio_bufptr = rp->rio_buf;
+    }
+    if (rp->rio_cnt == sizeof(rp->rio_buf))
+	return 0;
+
+    while ((nread = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+			 sizeof(rp->rio_buf) - rp->rio_cnt)) < 0) {
+	if (errno != EINTR) /* Interrupted by sig handler return */
+	    return -1;
+    }
+    rp->rio_cnt += nread;
+    return nread;
+}
+
+/*
+ * rio_scanline - Shared body of rio_readlinev and rio_readlinev_nb. When
+ *    nb is set and the descriptor has no more data, RIO_WOULDBLOCK is
+ *    returned and the partial line stays in the internal buffer.
+ */
+static ssize_t rio_scanline(rio_t *rp, char **linep, int nb)
+{
+    char *nl;
+    size_t scanned = 0;
+    ssize_t rc;
+
+    while (1) {
+	if (rp->rio_cnt > 0 &&
+	    (nl = rio_findnl(rp->rio_bufptr + scanned, rp->rio_cnt - scanned)) != NULL) {
+	    *linep = rp->rio_bufptr;
+	    return rio_consumeb(rp, nl - rp->rio_bufptr + 1);
+	}
+	scanned = rp->rio_cnt > 0 ? rp->rio_cnt : 0; /* Don't rescan after a refill */
+	if ((rc = rio_fillmore(rp)) < 0) {
+	    if (nb && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return RIO_WOULDBLOCK;
+	    return -1;
+	}
+	if (rc == 0) {  /* EOF or line fills the whole buffer */
+	    *linep = rp->rio_bufptr;
+	    return rio_consumeb(rp, rp->rio_cnt);
+	}
+    }
+}
+
+/*
+ * rio_readlinev - Return the next text line as a view into the internal
+ *    buffer. *linep points at the line and the return value is its length
+ *    including the newline. The view is valid until the next call on rp.
+ *    A line longer than RIO_BUFSIZE is returned in RIO_BUFSIZE pieces, and
+ *    a last line without a newline is returned as is. Returns 0 on EOF,
+ *    -1 on error.
+ */
+ssize_t rio_readlinev(rio_t *rp, char **linep)
+{
+    return rio_scanline(rp, linep, 0);
+}
+
+/*
+ * rio_peekmore - Do one more read into the internal buffer and point
+ *    *bufp at everything buffered but not yet consumed (*cntp bytes).
+ *    Unconsumed bytes keep their offset from *bufp across calls, so an
+ *    incremental parser can record offsets and resume. Returns the number
+ *    of new bytes, 0 on EOF or when the buffer is already full, -1 on
+ *    error, and RIO_WOULDBLOCK for a non-blocking descriptor with no data.
+ */
+ssize_t rio_peekmore(rio_t *rp, char **bufp, size_t *cntp)
+{
+    ssize_t rc = rio_fillmore(rp);
+
+    *bufp = rp->rio_bufptr;
+    *cntp = rp->rio_cnt > 0 ? rp->rio_cnt : 0;
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	return RIO_WOULDBLOCK;
+    return rc;
+}
+
+/*
+ * rio_peekb - Make up to n bytes (n <= RIO_BUFSIZE) available in the
+ *    internal buffer without consuming them. *bufp points at them and the
+ *    return value is how many are there, fewer than n only at EOF.
+ *    Returns -1 on error.
+ */
+ssize_t rio_peekb(rio_t *rp, char **bufp, size_t n)
+{
+    ssize_t rc;
+
+    if (n > sizeof(rp->rio_buf))
+	n = sizeof(rp->rio_buf);
+    while (rp->rio_cnt < 0 || (size_t)rp->rio_cnt < n) {
+	if ((rc = rio_fillmore(rp)) < 0)
+	    return -1;
+	if (rc == 0)
+	    break;  /* EOF */
+    }
+    *bufp = rp->rio_bufptr;
+    return rp->rio_cnt < 0 ? 0 : ((size_t)rp->rio_cnt < n ? rp->rio_cnt : n);
+}
+
+/*
+ * rio_consumeb - Drop n bytes that were returned by rio_peekb
+ */
+ssize_t rio_consumeb(rio_t *rp, size_t n)
+{
+    if (n > (size_t)rp->rio_cnt)
+	n = rp->rio_cnt;
+    rp->rio_bufptr += n;
+    rp->rio_cnt -= n;
+    return n;
+}
+
+/*********************************************************************
+ * Non-blocking Rio - the same buffering for descriptors in O_NONBLOCK
+ * mode, for use from an event loop. Reads return RIO_WOULDBLOCK instead
+ * of waiting and keep partial input in the rio_t; writes that the
+ * socket can't take yet are queued in a rio_out_t and sent later by
+ * rio_flush_nb once the descriptor polls writable.
+ *********************************************************************/
+
+/*
+ * rio_readinitb_nb - Put fd in non-blocking mode and reset rp
+ */
+int rio_readinitb_nb(rio_t *rp, int fd)
+{
+    int flags;
+
+    if ((flags = fcntl(fd, F_GETFL, 0)) < 0 ||
+	fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+	return -1;
+    rio_readinitb(rp, fd);
+    return 0;
+}
+
+/*
+ * rio_readlinev_nb - Like rio_readlinev, but returns RIO_WOULDBLOCK
+ *    when no complete line is buffered and the descriptor has no data.
+ */
+ssize_t rio_readlinev_nb(rio_t *rp, char **linep)
+{
+    return rio_scanline(rp, linep, 1);
+}
+
+/*
+ * rio_readnb_nb - Copy up to n bytes that are available right now.
+ *    Returns the count (> 0), 0 on EOF, RIO_WOULDBLOCK or -1.
+ */
+ssize_t rio_readnb_nb(rio_t *rp, void *usrbuf, size_t n)
+{
+    ssize_t rc;
+
+    if (rp->rio_cnt <= 0 && (rc = rio_fillmore(rp)) <= 0) {
+	if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return RIO_WOULDBLOCK;
+	return rc;  /* EOF or error */
+    }
+    if (n > (size_t)rp->rio_cnt)
+	n = rp->rio_cnt;
+    memcpy(usrbuf, rp->rio_bufptr, n);
+    return rio_consumeb(rp, n);
+}
+
+/*
+ * rio_outinit - Associate a descriptor with an empty output queue
+ */
+void rio_outinit(rio_out_t *op, int fd)
+{
+    op->out_fd = fd;
+    op->out_buf = NULL;
+    op->out_off = op->out_len = op->out_cap = 0;
+}
+
+/*
+ * rio_outfree - Release the output queue (unsent bytes are dropped)
+ */
+void rio_outfree(rio_out_t *op)
+{
+    free(op->out_buf);
+    rio_outinit(op, op->out_fd);
+}
+
+/*
+ * rio_flush_nb - Send as much of the queue as the descriptor accepts.
+ *    Returns the number of bytes still queued (0 when drained) or -1.
+ */
+ssize_t rio_flush_nb(rio_out_t *op)
+{
+    ssize_t nwritten;
+
+    while (op->out_off < op->out_len) {
+	if ((nwritten = write(op->out_fd, op->out_buf + op->out_off,
+			      op->out_len - op->out_off)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		break;
+	    return -1;  /* errno set by write() */
+	}
+	op->out_off += nwritten;
+    }
+    if (op->out_off == op->out_len)
+	op->out_off = op->out_len = 0;
+    return op->out_len - op->out_off;
+}
+
+/*
+ * rio_writen_nb - Write n bytes without blocking. Whatever the socket
+ *    doesn't take now is appended to the queue, so output order is kept.
+ *    Returns n, or -1 on a write or allocation error.
+ */
+ssize_t rio_writen_nb(rio_out_t *op, const void *usrbuf, size_t n)
+{
+    const char *bufp = usrbuf;
+    size_t nleft = n;
+    ssize_t nwritten;
+
+    /* Write directly only when nothing is queued ahead of us */
+    while (op->out_off == op->out_len && nleft > 0) {
+	if ((nwritten = write(op->out_fd, bufp, nleft)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		break;
+	    return -1;  /* errno set by write() */
+	}
+	nleft -= nwritten;
+	bufp += nwritten;
+    }
+    if (nleft > 0 && rio_outqueue(op, bufp, nleft) < 0)
+	return -1;
+    return n;
+}
+
+/*
+ * rio_outqueue - Append n bytes to the queue without writing, so that
+ *    several small messages go out in one rio_flush_nb call.
+ *    Returns n, or -1 if the queue can't grow.
+ */
+ssize_t rio_outqueue(rio_out_t *op, const void *usrbuf, size_t n)
+{
+    /* Compact or grow the buffer as needed */
+    if (op->out_len + n > op->out_cap && op->out_off > 0) {
+	memmove(op->out_buf, op->out_buf + op->out_off, op->out_len - op->out_off);
+	op->out_len -= op->out_off;
+	op->out_off = 0;
+    }
+    if (op->out_len + n > op->out_cap) {
+	size_t cap = op->out_cap ? op->out_cap : RIO_BUFSIZE;
+	char *newbuf;
+
+	while (cap < op->out_len + n)
+	    cap *= 2;
+	if ((newbuf = realloc(op->out_buf, cap)) == NULL)
+	    return -1;
+	op->out_buf = newbuf;
+	op->out_cap = cap;
+    }
+    memcpy(op->out_buf + op->out_len, usrbuf, n);
+    op->out_len += n;
+    return n;
+}
+
+/*
+ * rio_outpending - Number of queued bytes not yet written
+ */
+size_t rio_outpending(rio_out_t *op)
+{
+    return op->out_len - op->out_off;
+}
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -911,6 +1314,12 @@ void Rio_writen(int fd, void *usrbuf, size_t n)
 	unix_error("Rio_writen error");
 }
 
+void Rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    if (rio_writev(fd, iov, iovcnt) < 0)
+	unix_error("Rio_writev error");
+}
+
 void Rio_readinitb(rio_t *rp, int fd)
 {
     rio_readinitb(rp, fd);
@@ -934,6 +1343,24 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
     return rc;
 } 
 
+ssize_t Rio_readlinev(rio_t *rp, char **linep)
+{
+    ssize_t rc;
+
+    if ((rc = rio_readlinev(rp, linep)) < 0)
+	unix_error("Rio_readlinev error");
+    return rc;
+}
+
+ssize_t Rio_peekb(rio_t *rp, char **bufp, size_t n)
+{
+    ssize_t rc;
+
+    if ((rc = rio_peekb(rp, bufp, n)) < 0)
+	unix_error("Rio_peekb error");
+    return rc;
+}
+
 /******************************** 
  * Client/server helper functions
  ********************************/
@@ -949,7 +1376,7 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
 /* $begin open_clientfd */
 int open_clientfd(char *hostname, char *port) {
     int clientfd, rc;
-    struct addrinfo hints, *listp, *p;
+    struct addrinfo hints, *listp;
 
     /* Get a list of potential server addresses */
     memset(&hints, 0, sizeof(struct addrinfo));
@@ -961,27 +1388,182 @@ int open_clientfd(char *hostname, char *port) {
         return -2;
     }
   
-    /* Walk the list for one that we can successfully connect to */
-    for (p = listp; p; p = p->ai_next) {
-        /* Create a socket descriptor */
-        if ((clientfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) < 0) 
-            continue; /* Socket failed, try the next */
-
-        /* Connect to the server */
-        if (connect(clientfd, p->ai_addr, p->ai_addrlen) != -1) 
-            break; /* Success */
-        if (close(clientfd) < 0) { /* Connect failed, try another */  //line:netp:openclientfd:closefd
-            fprintf(stderr, "open_clientfd: close failed: %s\n", strerror(errno));
-            return -1;
-        } 
-    } 
+    clientfd = open_clientfd_ai(listp);
 
     /* Clean up */
     freeaddrinfo(listp);
-    if (!p) /* All connects failed */
+    return clientfd;
+}
+
+/* Happy Eyeballs (RFC 8305) connect parameters, see open_clientfd_config */
+static int connect_timeout_ms = 0;    /* overall limit, 0 = no limit */
+static int connect_delay_ms = 250;    /* stagger between attempts */
+static void (*connect_setup)(int fd); /* socket options before connect */
+
+/*
+ * open_clientfd_config - Set the overall connect timeout and the delay
+ *     before starting the next attempt while earlier ones are still
+ *     pending. Call once before any threads start connecting.
+ */
+void open_clientfd_config(int timeout_ms, int delay_ms)
+{
+    connect_timeout_ms = timeout_ms > 0 ? timeout_ms : 0;
+    connect_delay_ms = delay_ms > 0 ? delay_ms : 0;
+}
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/*
+ * open_clientfd_setup - Register a function that open_clientfd_ai calls
+ *     on every new socket before connect(), e.g. to set buffer sizes or
+ *     TCP_FASTOPEN_CONNECT. Call once before any threads start connecting.
+ */
+void open_clientfd_setup(void (*setup)(int fd))
+{
+    connect_setup = setup;
+}
+
+/*
+ * open_clientfd_ai - Connect to the addresses in listp, returning the
+ *     first socket that connects. Lets callers that already hold resolved
+ *     addresses (e.g. from a DNS cache) skip getaddrinfo.
+ *
+ *     Attempts are non-blocking and staggered by connect_delay_ms with
+ *     address families interleaved, so a blackholed first address only
+ *     costs the stagger delay instead of a full SYN timeout. A failed
+ *     attempt starts the next one at once. The losers are closed and the
+ *     winner is returned in blocking mode.
+ *
+ *     On error, returns -1 with errno set (ETIMEDOUT if the overall
+ *     timeout expired).
+ */
+int open_clientfd_ai(struct addrinfo *listp)
+{
+    struct addrinfo *p, **order;
+    struct pollfd *pfds;
+    int n = 0, i, j, next = 0, npending = 0, clientfd = -1, err = ECONNREFUSED;
+    long deadline, next_start;
+
+    for (p = listp; p; p = p->ai_next)
+        n++;
+    if (n == 0) {
+        errno = EHOSTUNREACH;
         return -1;
-    else    /* The last connect succeeded */
-        return clientfd;
+    }
+    order = malloc(n * sizeof(*order));
+    pfds = malloc(n * sizeof(*pfds));
+    if (!order || !pfds) {
+        free(order);
+        free(pfds);
+        return -1;
+    }
+
+    /* Interleave address families: first family of the list, then the other */
+    {
+        int fam = listp->ai_family, k = 0;
+        struct addrinfo *a = listp, *b = listp;
+        while (k < n) {
+            while (a && a->ai_family != fam) a = a->ai_next;
+            if (a) { order[k++] = a; a = a->ai_next; }
+            while (b && b->ai_family == fam) b = b->ai_next;
+            if (b) { order[k++] = b; b = b->ai_next; }
+        }
+    }
+
+    deadline = connect_timeout_ms ? now_ms() + connect_timeout_ms : 0;
+    next_start = now_ms();
+    while (clientfd < 0) {
+        long now = now_ms(), wait;
+
+        /* Start the next attempt when its turn comes or nothing is pending */
+        if (next < n && (npending == 0 || now >= next_start)) {
+            p = order[next++];
+            int fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK, p->ai_protocol);
+            if (fd < 0) {
+                err = errno;
+                continue;
+            }
+            if (connect_setup)
+                connect_setup(fd);
+            if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+                clientfd = fd;
+                break;
+            }
+            if (errno != EINPROGRESS) {
+                err = errno;
+                close(fd);
+                continue;
+            }
+            pfds[npending].fd = fd;
+            pfds[npending].events = POLLOUT;
+            npending++;
+            next_start = now + connect_delay_ms;
+        }
+        if (npending == 0) {
+            if (next >= n)
+                break; /* All connects failed */
+            continue;
+        }
+
+        /* Wait for a pending attempt, the next stagger, or the deadline */
+        wait = -1;
+        if (next < n)
+            wait = next_start > now ? next_start - now : 0;
+        if (deadline) {
+            if (now >= deadline) {
+                err = ETIMEDOUT;
+                break;
+            }
+            if (wait < 0 || deadline - now < wait)
+                wait = deadline - now;
+        }
+        if (poll(pfds, npending, (int)wait) < 0) {
+            if (errno == EINTR)
+                continue;
+            err = errno;
+            break;
+        }
+
+        for (i = 0; i < npending; ) {
+            int soerr = 0;
+            socklen_t len = sizeof(soerr);
+            if (!pfds[i].revents) {
+                i++;
+                continue;
+            }
+            if (getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &soerr, &len) < 0)
+                soerr = errno;
+            if (soerr == 0) {
+                clientfd = pfds[i].fd;
+                pfds[i] = pfds[--npending];
+                break;
+            }
+            /* This attempt failed; drop it and let the next one start now */
+            err = soerr;
+            close(pfds[i].fd);
+            pfds[i] = pfds[--npending];
+            next_start = 0;
+        }
+    }
+
+    /* Close the attempts that lost the race */
+    for (j = 0; j < npending; j++)
+        close(pfds[j].fd);
+    free(order);
+    free(pfds);
+
+    if (clientfd < 0) {
+        errno = err;
+        return -1;
+    }
+    /* Callers expect a blocking socket */
+    fcntl(clientfd, F_SETFL, fcntl(clientfd, F_GETFL) & ~O_NONBLOCK);
+    return clientfd;
 }
 /* $end open_clientfd */
 